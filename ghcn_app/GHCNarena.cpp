@@ -0,0 +1,71 @@
+#include "GHCNarena.hpp"
+
+#include <stdlib.h>
+#include <new>
+
+// Every allocation starts on a multiple of this, which is enough for
+// double and int64_t.
+static const size_t ARENA_ALIGN=16;
+
+
+GHCNArena::GHCNArena(size_t blockBytes)
+{
+  mBlockBytes=blockBytes;
+  mCurrent=0;
+  mUsed=0;
+}
+
+GHCNArena::~GHCNArena()
+{
+  for(size_t ib=0; ib<mBlocks.size(); ib++)
+  {
+    free(mBlocks[ib].data);
+  }
+}
+
+void* GHCNArena::Allocate(size_t bytes)
+{
+  bytes=(bytes+ARENA_ALIGN-1)&~(ARENA_ALIGN-1);
+
+  // Carry on with the current block, or move on to the next one that
+  // has room.  (Blocks skipped over are only used again after Reset().)
+  while(mCurrent<mBlocks.size())
+  {
+    if(mUsed+bytes<=mBlocks[mCurrent].size)
+    {
+      void *pp=mBlocks[mCurrent].data+mUsed;
+      mUsed+=bytes;
+      return pp;
+    }
+    mCurrent++;
+    mUsed=0;
+  }
+
+  Block block;
+  block.size=bytes>mBlockBytes ? bytes : mBlockBytes;
+  block.data=(char*)malloc(block.size);
+  if(block.data==NULL)
+  {
+    throw std::bad_alloc();
+  }
+  mBlocks.push_back(block);
+  mCurrent=mBlocks.size()-1;
+  mUsed=bytes;
+  return block.data;
+}
+
+void GHCNArena::Reset(void)
+{
+  mCurrent=0;
+  mUsed=0;
+}
+
+size_t GHCNArena::BytesReserved(void) const
+{
+  size_t total=0;
+  for(size_t ib=0; ib<mBlocks.size(); ib++)
+  {
+    total+=mBlocks[ib].size;
+  }
+  return total;
+}
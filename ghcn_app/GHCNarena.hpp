@@ -0,0 +1,68 @@
+#ifndef GHCNARENA_HPP
+#define GHCNARENA_HPP
+
+#include <stddef.h>
+#include <vector>
+
+//
+// Monotonic arena for scratch arrays:  allocations are carved out of
+// big blocks one after another and never freed on their own.  Reset()
+// makes all the blocks available again without giving them back to
+// the heap, so a pass that runs again with the same sizes doesn't
+// touch malloc at all;  the destructor frees everything in one go.
+//
+// Not thread-safe:  allocate up front, then hand the arrays out to
+// the worker threads.
+//
+class GHCNArena
+{
+ public:
+
+  explicit GHCNArena(size_t blockBytes=1<<20);
+  virtual ~GHCNArena();
+
+  // bytes of uninitialised memory, aligned for any basic type.
+  void* Allocate(size_t bytes);
+
+  // n elements of T (plain data only -- no constructors are run).
+  template<class T>
+  T* AllocateArray(size_t n) { return (T*)Allocate(n*sizeof(T)); }
+
+  // Same, with every element set to value.
+  template<class T>
+  T* AllocateFilled(size_t n, const T& value)
+  {
+    T *pp=AllocateArray<T>(n);
+    for(size_t ii=0; ii<n; ii++)
+    {
+      pp[ii]=value;
+    }
+    return pp;
+  }
+
+  // Forget every allocation but keep the blocks for reuse.
+  void  Reset(void);
+
+  // Bytes held in blocks.
+  size_t BytesReserved(void) const;
+
+ protected:
+
+  struct Block
+  {
+    char *data;
+    size_t size;
+  };
+  std::vector<Block> mBlocks;
+
+  size_t mBlockBytes;
+  size_t mCurrent;   // block being allocated from
+  size_t mUsed;      // bytes of it used so far
+
+ private:
+  GHCNArena(const GHCNArena&);
+  GHCNArena& operator=(const GHCNArena&);
+
+};
+
+#endif // GHCNARENA_HPP
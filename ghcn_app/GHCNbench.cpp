@@ -0,0 +1,286 @@
+#include "GHCNcsv.hpp"
+#include "GHCNbench.hpp"
+#include "GHCNtimer.hpp"
+#include "GHCNparallel.hpp"
+
+#include <random>
+#include <sstream>
+
+#include <math.h>
+#include <string.h>
+
+
+long GHCNWriteSyntheticFile(const char *fileName, int nstations, 
+                            int firstYear, int nyears, 
+                            double missingRate, unsigned seed)
+{
+  FILE *fp=fopen(fileName, "wb");
+  if(fp==NULL)
+  {
+    return -1;
+  }
+
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::normal_distribution<double> noise(0.0, 15.0);
+
+  long nlines=0;
+  int country=100;
+  int wmo=10000;
+  char line[128];
+
+  // About 700 countries' worth of stations, whatever nstations is.
+  double nextCountryRate=MIN(0.5, 700.0/MAX(1,nstations));
+
+  for(int is=0; is<nstations; is++)
+  {
+    // Station IDs have to come out in increasing order, as they do in
+    // the real files:  keys sort by country first, so the country only
+    // ever moves up, and the WMO number goes up within a country.
+    if(uniform(rng)<nextCountryRate && country<999)
+    {
+      country++;
+      wmo=10000;
+    }
+    wmo+=1+(int)(uniform(rng)*20);
+    if(wmo>99999)
+    {
+      wmo=10000;
+      country=MIN(999,country+1);
+    }
+
+    // Most stations start well after firstYear and some stop early.
+    int y0=firstYear+(int)(uniform(rng)*uniform(rng)*nyears);
+    int y1=firstYear+nyears-1-(int)(uniform(rng)*uniform(rng)*nyears/4);
+    double base=uniform(rng)*500.0-200.0;
+
+    for(int yy=y0; yy<=y1; yy++)
+    {
+      int nn=snprintf(line, sizeof(line), "%03d%05d%03d%d%04d", 
+                      country, wmo, 0, 0, yy);
+      for(int imm=0; imm<12; imm++)
+      {
+	int tt=-9999;
+	if(uniform(rng)>=missingRate)
+	{
+	  // Seasonal cycle plus a slow trend plus weather.
+	  double vv=base+120.0*sin((imm-3)*3.14159265/6.0)
+	    +0.1*(yy-firstYear)+noise(rng);
+	  tt=MAX(-999,MIN(9999,(int)floor(vv+0.5)));
+	}
+	nn+=snprintf(line+nn, sizeof(line)-nn, "%5d", tt);
+      }
+      line[nn++]='\n';
+      if(fwrite(line, 1, nn, fp)!=(size_t)nn)
+      {
+	fclose(fp);
+	return -1;
+      }
+      nlines++;
+    }
+  }
+
+  if(fclose(fp)!=0)
+  {
+    return -1;
+  }
+  return nlines;
+}
+
+
+// Best (smallest) wall time seen for one stage over all repeats, and the
+// peak RSS once it had finished.
+struct BenchStage
+{
+  const char *name;
+  double best;
+  double cpu;
+  size_t peakRSS;
+};
+
+static void BenchUsage(void)
+{
+  cerr << endl
+       << "Usage: gcsv --bench" << endl
+       << "         [-s (int)stations (default 5000)] \\ " << endl
+       << "         [-y (int)years from 1880 (default 130)] \\ " << endl
+       << "         [-m (double)missing-value-rate (default 0.1)] \\ " << endl
+       << "         [-r (int)repeats (default 3)] \\ " << endl
+       << "         [-j (int)threads (0 = all cores, default 1)] \\ " << endl
+       << "         [-z (int)random-seed] \\ " << endl
+       << "         [-f (char*)synthetic-file (default gcsv-bench.mean)] \\ " 
+       << endl
+       << "         [-k (keep the synthetic file)] \\ " << endl
+       << "         [-h (this help)] " << endl
+       << endl;
+}
+
+int GHCNBenchmark(int argc, char **argv)
+{
+  void DumpSmoothedResults(GHCN **ghcn, int nghcn);
+
+  int nstations=5000;
+  int nyears=130;
+  double missingRate=0.1;
+  int nrepeats=3;
+  int nthreads=1;
+  unsigned seed=1;
+  string fileName="gcsv-bench.mean";
+  bool keepFile=false;
+  int avgNyear=GHCN::DEFAULT_AVG_NYEAR;
+  int minBaselineSampleCount=GHCN::DEFAULT_MIN_BASELINE_SAMPLE_COUNT;
+
+  int opt;
+  while((opt=getopt(argc,argv,"s:y:m:r:j:z:f:kh"))!=-1)
+  {
+    switch(opt)
+    {
+      case 's':
+	nstations=atoi(optarg);
+	break;
+      case 'y':
+	nyears=atoi(optarg);
+	break;
+      case 'm':
+	missingRate=atof(optarg);
+	break;
+      case 'r':
+	nrepeats=atoi(optarg);
+	break;
+      case 'j':
+	nthreads=atoi(optarg);
+	break;
+      case 'z':
+	seed=(unsigned)atoi(optarg);
+	break;
+      case 'f':
+	fileName=optarg;
+	break;
+      case 'k':
+	keepFile=true;
+	break;
+      case 'h':
+	BenchUsage();
+	return 0;
+      default:
+	BenchUsage();
+	return 1;
+    }
+  }
+  if(nstations<1 || nyears<1 || nrepeats<1 || nthreads<0
+     || missingRate<0.0 || missingRate>1.0)
+  {
+    BenchUsage();
+    return 1;
+  }
+  if(nthreads==0)
+  {
+    nthreads=GHCNHardwareThreads();
+  }
+
+  cerr << "Generating " << nstations << " stations x up to " << nyears 
+       << " years in " << fileName << "..." << endl;
+  GHCNStopwatch genTime;
+  long nrecords=GHCNWriteSyntheticFile(fileName.c_str(), nstations, 
+                                       GHCN::MIN_GISS_YEAR, nyears,
+                                       missingRate, seed);
+  if(nrecords<0)
+  {
+    cerr << "Can't write " << fileName << endl;
+    return 1;
+  }
+  cerr << "  " << nrecords << " records in " << genTime.WallSeconds() 
+       << " s" << endl;
+
+  BenchStage stages[]=
+  {
+    { "ReadTemps", 0, 0, 0 },
+    { "ComputeBaselines", 0, 0, 0 },
+    { "ComputeGlobalAverageAnomalies", 0, 0, 0 },
+    { "MergeMonthsToYear", 0, 0, 0 },
+    { "ComputeMovingAvg", 0, 0, 0 },
+    { "Output", 0, 0, 0 },
+  };
+  const int nstages=sizeof(stages)/sizeof(stages[0]);
+  string outName=fileName+".csv";
+
+  for(int ir=0; ir<nrepeats; ir++)
+  {
+    GHCNStopwatch timer;
+    double wall[nstages];
+    double cpu[nstages];
+    int is=0;
+
+    // Time one stage and restart the clock for the next.
+#define BENCH_LAP()  wall[is]=timer.WallSeconds(); \
+                     cpu[is]=timer.CpuSeconds(); \
+                     stages[is].peakRSS=GHCNPeakRSSBytes(); \
+                     is++; timer.Restart()
+
+    GHCN *ghcn=new GHCN(fileName.c_str(), avgNyear);
+    ghcn->SetNumThreads(nthreads);
+    ghcn->ReadTemps();
+    BENCH_LAP();
+    ghcn->ComputeBaselines();
+    BENCH_LAP();
+    ghcn->ComputeGlobalAverageAnomalies(minBaselineSampleCount);
+    BENCH_LAP();
+    ghcn->MergeMonthsToYear(GHCN::MERGE_AVG);
+    BENCH_LAP();
+    ghcn->ComputeMovingAvg(avgNyear);
+    BENCH_LAP();
+    {
+      ofstream out(outName.c_str());
+      streambuf *saved=cout.rdbuf(out.rdbuf());
+      DumpSmoothedResults(&ghcn, 1);
+      cout.flush();
+      cout.rdbuf(saved);
+    }
+    BENCH_LAP();
+#undef BENCH_LAP
+
+    delete ghcn;
+
+    for(is=0; is<nstages; is++)
+    {
+      if(ir==0 || wall[is]<stages[is].best)
+      {
+	stages[is].best=wall[is];
+	stages[is].cpu=cpu[is];
+      }
+    }
+  }
+
+  remove(outName.c_str());
+  if(!keepFile)
+  {
+    remove(fileName.c_str());
+  }
+
+  // Report the best of the repeats for each stage.
+  cout << "stations=" << nstations << " years=" << nyears 
+       << " missing=" << missingRate << " records=" << nrecords
+       << " threads=" << nthreads << " repeats=" << nrepeats 
+       << " parse-kernel=" << GHCNParseTemps12Kernel() << endl;
+  cout << left << setw(32) << "stage" << right 
+       << setw(12) << "wall_s" << setw(12) << "cpu_s" 
+       << setw(16) << "records/s" << setw(14) << "peak_rss_MB" << endl;
+
+  double total=0.0;
+  for(int is=0; is<nstages; is++)
+  {
+    total+=stages[is].best;
+    cout << left << setw(32) << stages[is].name << right << fixed
+	 << setprecision(6) << setw(12) << stages[is].best 
+	 << setw(12) << stages[is].cpu
+	 << setprecision(0) << setw(16) 
+	 << (stages[is].best>0 ? nrecords/stages[is].best : 0.0)
+	 << setprecision(1) << setw(14) << stages[is].peakRSS/1048576.0 
+	 << endl;
+  }
+  cout << left << setw(32) << "total" << right << setprecision(6)
+       << setw(12) << total << setw(12) << "" << setprecision(0) << setw(16)
+       << (total>0 ? nrecords/total : 0.0) << endl;
+
+  return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef GHCNBENCH_HPP
+#define GHCNBENCH_HPP
+
+//
+// Benchmark mode:  generate a synthetic GHCN v2 file of a chosen size
+// and time each stage of crunching it.
+//
+//   ./gcsv.exe --bench [-s stations] [-y years] [-m missing-rate] 
+//                      [-r repeats] [-j threads] [-z seed] [-f file] [-k]
+//
+
+
+// Write nstations stations' worth of v2-format data lines to fileName.
+// Each station covers a random stretch of up to nyears years ending at
+// most at firstYear+nyears-1;  each monthly value is -9999 (missing)
+// with probability missingRate.  Returns the number of lines written,
+// or -1 if the file can't be written.
+long GHCNWriteSyntheticFile(const char *fileName, int nstations, 
+                            int firstYear, int nyears, 
+                            double missingRate, unsigned seed);
+
+// Entry point for "gcsv --bench ...";  argv[0] is "--bench".
+int GHCNBenchmark(int argc, char **argv);
+
+#endif // GHCNBENCH_HPP
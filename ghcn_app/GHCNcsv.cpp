@@ -1,31 +1,431 @@
 #include "GHCNcsv.hpp"
 
-// Globals, yuck.  
-int avgNyear_g;
-int minBaselineSampleCount_g;
+#include <string.h>
+#include <sstream>
+#include <atomic>
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#endif
+
+#include "GHCNparallel.hpp"
+#include "GHCNoutput.hpp"
+
 // #define MAXFILES (10)
 
 
-GHCN::GHCN(const char  *inFile, const int& avgNyear)
+GHCNTempStore::GHCNTempStore()
+{
+}
+
+unsigned GHCNTempStore::ValidMonths(const float *temps)
+{
+  unsigned mask=0;
+  for(int imm=0; imm<12; imm++)
+  {
+    mask|=(unsigned)(temps[imm]>GHCN::GHCN_NOTEMP()+GHCN::ERR_EPS())<<imm;
+  }
+  return mask;
+}
+
+void GHCNTempStore::Clear(void)
+{
+  vector<GHCNStationKey>().swap(mStationId);
+  vector<int>().swap(mFirstYear);
+  vector<int>().swap(mNumYears);
+  vector<size_t>().swap(mOffset);
+  vector<float>().swap(mTemps);
+  vector<uint16_t>().swap(mMask);
+  vector<PendingRecord>().swap(mPending);
+  unordered_map<GHCNStationKey,int>().swap(mIndex);
+}
+
+size_t GHCNTempStore::MemoryBytes(void) const
+{
+  return mStationId.capacity()*sizeof(GHCNStationKey)
+    + mFirstYear.capacity()*sizeof(int)
+    + mNumYears.capacity()*sizeof(int)
+    + mOffset.capacity()*sizeof(size_t)
+    + mTemps.capacity()*sizeof(float)
+    + mMask.capacity()*sizeof(uint16_t)
+    + mPending.capacity()*sizeof(PendingRecord)
+    + mIndex.size()*(sizeof(GHCNStationKey)+sizeof(int)+2*sizeof(void*));
+}
+
+// Pad the image out to the next 8-byte boundary.
+static size_t Align8(size_t nbytes)
+{
+  return (nbytes+7)&~(size_t)7;
+}
+
+static bool WritePadded(FILE *fp, const void *data, size_t nbytes)
+{
+  static const char zeros[8]={0};
+  size_t npad=Align8(nbytes)-nbytes;
+  return fwrite(data,1,nbytes,fp)==nbytes && fwrite(zeros,1,npad,fp)==npad;
+}
+
+bool GHCNTempStore::Write(FILE *fp) const
+{
+  uint64_t counts[2];
+  counts[0]=mStationId.size();
+  counts[1]=NumRows();
+
+  return WritePadded(fp, counts, sizeof(counts))
+    && WritePadded(fp, mStationId.data(), 
+                   mStationId.size()*sizeof(GHCNStationKey))
+    && WritePadded(fp, mFirstYear.data(), mFirstYear.size()*sizeof(int))
+    && WritePadded(fp, mNumYears.data(), mNumYears.size()*sizeof(int))
+    && WritePadded(fp, mTemps.data(), mTemps.size()*sizeof(float))
+    && WritePadded(fp, mMask.data(), mMask.size()*sizeof(uint16_t));
+}
+
+bool GHCNTempStore::Read(const char *image, size_t size)
+{
+  uint64_t counts[2];
+
+  Clear();
+
+  if(size<sizeof(counts))
+  {
+    return false;
+  }
+  memcpy(counts, image, sizeof(counts));
+
+  size_t ns=(size_t)counts[0];
+  size_t nrows=(size_t)counts[1];
+  size_t keyBytes=ns*sizeof(GHCNStationKey);
+  size_t intBytes=Align8(ns*sizeof(int));
+  size_t tempsBytes=12*nrows*sizeof(float);
+  if(size!=sizeof(counts)+keyBytes+2*intBytes+tempsBytes
+          +Align8(nrows*sizeof(uint16_t)))
+  {
+    return false;
+  }
+
+  const char *pp=image+sizeof(counts);
+  const GHCNStationKey *ids=(const GHCNStationKey*)pp;
+  pp+=keyBytes;
+  const int *firstYears=(const int*)pp;
+  const int *numYears=(const int*)(pp+intBytes);
+  const float *temps=(const float*)(pp+2*intBytes);
+  const uint16_t *masks=(const uint16_t*)(pp+2*intBytes+tempsBytes);
+
+  mStationId.assign(ids, ids+ns);
+  mFirstYear.assign(firstYears, firstYears+ns);
+  mNumYears.assign(numYears, numYears+ns);
+  mOffset.resize(ns);
+
+  size_t row=0;
+  for(size_t is=0; is<ns; is++)
+  {
+    if(mNumYears[is]<=0 || (is>0 && mStationId[is]<=mStationId[is-1]))
+    {
+      Clear();
+      return false;
+    }
+    mOffset[is]=12*row;
+    row+=mNumYears[is];
+  }
+  if(row!=nrows)
+  {
+    Clear();
+    return false;
+  }
+
+  mTemps.assign(temps, temps+12*nrows);
+  mMask.assign(masks, masks+nrows);
+  BuildIndex();
+  return true;
+}
+
+void GHCNTempStore::BuildIndex(void)
+{
+  mIndex.clear();
+  mIndex.reserve(mStationId.size());
+  for(size_t is=0; is<mStationId.size(); is++)
+  {
+    mIndex[mStationId[is]]=(int)is;
+  }
+}
+
+void GHCNTempStore::Reset(void)
+{
+  mStationId.clear();
+  mFirstYear.clear();
+  mNumYears.clear();
+  mOffset.clear();
+  mTemps.clear();
+  mMask.clear();
+  mPending.clear();
+  mIndex.clear();
+}
+
+void GHCNTempStore::Extract(const vector<int>& stations, 
+                            GHCNTempStore& out) const
+{
+  out.Clear();
+
+  size_t nrows=0;
+  for(size_t ii=0; ii<stations.size(); ii++)
+  {
+    nrows+=mNumYears[stations[ii]];
+  }
+  out.mStationId.reserve(stations.size());
+  out.mFirstYear.reserve(stations.size());
+  out.mNumYears.reserve(stations.size());
+  out.mOffset.reserve(stations.size());
+  out.mTemps.reserve(12*nrows);
+  out.mMask.reserve(nrows);
+
+  for(size_t ii=0; ii<stations.size(); ii++)
+  {
+    int is=stations[ii];
+    size_t row0=mOffset[is]/12;
+
+    out.mStationId.push_back(mStationId[is]);
+    out.mFirstYear.push_back(mFirstYear[is]);
+    out.mNumYears.push_back(mNumYears[is]);
+    out.mOffset.push_back(out.mTemps.size());
+    out.mTemps.insert(out.mTemps.end(), mTemps.begin()+12*row0,
+                      mTemps.begin()+12*(row0+mNumYears[is]));
+    out.mMask.insert(out.mMask.end(), mMask.begin()+row0,
+                     mMask.begin()+row0+mNumYears[is]);
+  }
+
+  out.BuildIndex();
+}
+
+bool GHCNTempStore::ReplaceRecord(GHCNStationKey station, int year, 
+                                  const float *temps)
+{
+  int is=FindStation(station);
+  if(is<0 || year<mFirstYear[is] || year>=mFirstYear[is]+mNumYears[is])
+  {
+    return false;
+  }
+
+  size_t row=mOffset[is]/12+(year-mFirstYear[is]);
+  copy(temps, temps+12, &mTemps[12*row]);
+  mMask[row]=(uint16_t)(PRESENT_BIT|ValidMonths(temps));
+  return true;
+}
+
+void GHCNTempStore::GrowLastStation(int year, int nyears, bool before)
+{
+  int is=NumStations()-1;
+
+  if(before)
+  {
+    mTemps.insert(mTemps.begin()+mOffset[is], 12*(size_t)nyears, NOTEMP());
+    mMask.insert(mMask.begin()+mOffset[is]/12, nyears, 0);
+    mFirstYear[is]=year;
+  }
+  else
+  {
+    mTemps.resize(mTemps.size()+12*(size_t)nyears, NOTEMP());
+    mMask.resize(mMask.size()+nyears, 0);
+  }
+  mNumYears[is]+=nyears;
+}
+
+void GHCNTempStore::AddRecord(GHCNStationKey station, int year, 
+                              const float *temps)
+{
+  int is=NumStations()-1;
+
+  if(is>=0 && station==mStationId[is])
+  {
+    // Another year for the station we're currently appending to.
+    // Grow its year range at either end as needed (it's the last 
+    // station in the flat array, so growing is cheap).
+    if(year<mFirstYear[is])
+    {
+      GrowLastStation(year, mFirstYear[is]-year, true);
+    }
+    else if(year>=mFirstYear[is]+mNumYears[is])
+    {
+      GrowLastStation(year, year-(mFirstYear[is]+mNumYears[is])+1, false);
+    }
+  }
+  else if(is<0 || station>mStationId[is])
+  {
+    // New station -- start a new block at the end of the flat array.
+    mStationId.push_back(station);
+    mFirstYear.push_back(year);
+    mNumYears.push_back(0);
+    mOffset.push_back(mTemps.size());
+    is++;
+    GrowLastStation(year, 1, false);
+  }
+  else
+  {
+    // Out of station order -- hang onto it until Finalize().
+    PendingRecord rec;
+    rec.station=station;
+    rec.year=year;
+    copy(temps, temps+12, rec.temps);
+    mPending.push_back(rec);
+    return;
+  }
+
+  size_t row=mOffset[is]/12+(year-mFirstYear[is]);
+  copy(temps, temps+12, &mTemps[12*row]);
+  mMask[row]=(uint16_t)(PRESENT_BIT|ValidMonths(temps));
+}
+
+void GHCNTempStore::Append(const GHCNTempStore& other)
+{
+  for(int js=0; js<other.NumStations(); js++)
+  {
+    GHCNStationKey station=other.mStationId[js];
+
+    if(NumStations()==0 || station>mStationId.back())
+    {
+      // Past the end of what we have -- copy the whole block over.
+      size_t row0=other.mOffset[js]/12;
+      size_t nrows=other.mNumYears[js];
+
+      mStationId.push_back(station);
+      mFirstYear.push_back(other.mFirstYear[js]);
+      mNumYears.push_back(other.mNumYears[js]);
+      mOffset.push_back(mTemps.size());
+      mTemps.insert(mTemps.end(), other.mTemps.begin()+12*row0,
+                    other.mTemps.begin()+12*(row0+nrows));
+      mMask.insert(mMask.end(), other.mMask.begin()+row0,
+                   other.mMask.begin()+row0+nrows);
+    }
+    else
+    {
+      for(int iy=0; iy<other.mNumYears[js]; iy++)
+      {
+        if(other.IsPresent(js,iy))
+        {
+          AddRecord(station, other.mFirstYear[js]+iy, other.Row(js,iy));
+        }
+      }
+    }
+  }
+}
+
+void GHCNTempStore::Finalize(void)
 {
-  int ichar=0;
+  if(mPending.empty())
+  {
+    BuildIndex();
+    return;
+  }
+
+  // Group the held-back records by station, keeping their arrival order
+  // so that later records for a station-year still win.
+  stable_sort(mPending.begin(), mPending.end(), PendingStationLess);
+
+  // Re-append everything in station order into a fresh store: for each
+  // station its in-order rows first, then its held-back records.
+  GHCNTempStore merged;
+  merged.mTemps.reserve(mTemps.size()+12*mPending.size());
+
+  int is=0;
+  size_t ip=0;
+  while(is<NumStations() || ip<mPending.size())
+  {
+    GHCNStationKey station;
+    if(ip>=mPending.size() 
+       || (is<NumStations() && mStationId[is]<=mPending[ip].station))
+    {
+      station=mStationId[is];
+    }
+    else
+    {
+      station=mPending[ip].station;
+    }
+
+    if(is<NumStations() && mStationId[is]==station)
+    {
+      for(int iy=0; iy<mNumYears[is]; iy++)
+      {
+        if(IsPresent(is,iy))
+        {
+          merged.AddRecord(station, mFirstYear[is]+iy, Row(is,iy));
+        }
+      }
+      is++;
+    }
+
+    for(; ip<mPending.size() && mPending[ip].station==station; ip++)
+    {
+      merged.AddRecord(station, mPending[ip].year, mPending[ip].temps);
+    }
+  }
+
+  mStationId.swap(merged.mStationId);
+  mFirstYear.swap(merged.mFirstYear);
+  mNumYears.swap(merged.mNumYears);
+  mOffset.swap(merged.mOffset);
+  mTemps.swap(merged.mTemps);
+  mMask.swap(merged.mMask);
+  vector<PendingRecord>().swap(mPending);
+  BuildIndex();
+}
+
+
+// The settings are defined as well as declared, so they can be passed
+// by reference -- GHCN(inFile, GHCN::DEFAULT_AVG_NYEAR) for one.
+const int GHCN::MIN_GISS_YEAR;
+const int GHCN::FIRST_BASELINE_YEAR;
+const int GHCN::LAST_BASELINE_YEAR;
+const int GHCN::DEFAULT_MIN_BASELINE_SAMPLE_COUNT;
+const int GHCN::DEFAULT_AVG_NYEAR;
+const int GHCN::MAX_AVG_NYEAR;
+const int GHCN::DEFAULT_MIN_DAYS_PER_MONTH;
+
 
-  try
+GHCN::GHCN(const char  *inFile, const int& avgNyear)
+{
+  mNumThreads=1;
+  mbLoadedFromCache=false;
+  mDuplicateMode=DUPLICATES_SEPARATE;
+  memset(&mCounts, 0, sizeof(mCounts));
+  mStationsKept=0;
+  mStationsDropped=0;
+  mDeltaStations=0;
+  mBaselinesRecomputed=0;
+  mStateMinBaselineSampleCount=0;
+  mInventory=NULL;
+  mGrid=NULL;
+  mStationsUnlocated=0;
+  mGridCellsUsed=0;
+  mRegion=NULL;
+  mStationsFilteredOut=0;
+  mbUseSubset=false;
+  mFirstBaselineYear=FIRST_BASELINE_YEAR;
+  mLastBaselineYear=LAST_BASELINE_YEAR;
+  mbBaselinesValid=false;
+  mAnomalyFirstYear=0;
+  mAnomalyNumYears=0;
+  mbDropQcFlagged=true;
+  mDailyElement=DAILY_TAVG;
+  mMinDaysPerMonth=DEFAULT_MIN_DAYS_PER_MONTH;
+  mInputName=inFile;
+  mCompression=GHCN_COMPRESSION_NONE;
+  mInputStream=NULL;
+  mbReadInBlocks=false;
+
+  if(GHCNListDirectory(inFile, ".dly", mDailyFiles))
+  {
+    mbFileIsOpen=!mDailyFiles.empty();
+  }
+  else if((mInputStream=GHCNOpenStream(inFile))!=NULL)
   {
-    mInputFstream = new fstream(inFile,fstream::in);
     mbFileIsOpen=true;
   }
-  catch(...) // some sort of file open failure
+  else
   {
-    cerr << endl << endl;
-    cerr << "Failed to create a stream for " << inFile << endl;
-    cerr << "Exiting.... " << endl;
-    cerr << endl << endl;
-    mInputFstream->close(); // make sure it's closed
-    exit(1);
+    mbFileIsOpen=mInputFile.Open(inFile);
   }
 
-  if(!mInputFstream->is_open())
+  if(!mbFileIsOpen)
   {
     cerr << endl << endl;
     cerr << "Failed to open " << inFile << endl;
@@ -33,22 +433,56 @@ GHCN::GHCN(const char  *inFile, const int& avgNyear)
     cerr << endl << endl;
     exit(1);
   }
-  
-  mCbuf = new char[BUFLEN];
-  mCcountry = &mCbuf[ichar];
-  ichar+=3;
-  mCstation = &mCbuf[ichar];
-  ichar+=9;
-  mCyear = &mCbuf[ichar];
-  ichar+=4;
-  mCtemps = &mCbuf[ichar];
+
+  if(!mDailyFiles.empty())
+  {
+    mFormat=GHCN_FORMAT_DAILY;
+    return;
+  }
+
+  if(mInputStream==NULL)
+  {
+    mCompression=GHCNDetectCompression(mInputFile.Data(), mInputFile.Size());
+  }
+  if(mInputStream==NULL && mCompression==GHCN_COMPRESSION_NONE)
+  {
+    mFormat=GHCNDetectFormat(mInputFile.Data(), mInputFile.Size());
+  }
+  else
+  {
+    // Start reading or decompressing straight away;  the format comes
+    // from the first block out.
+    const char *begin, *end;
+    if(mInputStream!=NULL)
+    {
+      mDecompressor.Start(mInputStream);
+    }
+    else
+    {
+      mDecompressor.Start(mInputFile.Data(), mInputFile.Size(), mCompression);
+    }
+    mFormat = mDecompressor.PeekBlock(begin, end) 
+      ? GHCNDetectFormat(begin, end-begin) : GHCN_FORMAT_V2;
+    mCompression=mDecompressor.Compression();
+    mbReadInBlocks=true;
+  }
   
 }
 
 GHCN::~GHCN()
 {
-  delete mInputFstream;
-  delete[] mCbuf;
+  CloseStream();
+}
+
+void GHCN::CloseStream(void)
+{
+  // (The reading thread has to be done with it first.)
+  mDecompressor.Stop();
+  if(mInputStream!=NULL && mInputStream!=stdin)
+  {
+    fclose(mInputStream);
+  }
+  mInputStream=NULL;
 }
 
 bool GHCN::IsFileOpen()
@@ -59,24 +493,22 @@ bool GHCN::IsFileOpen()
 
 void GHCN::DumpResults()
 {
-  // map<int, vector<double> >::iterator iyy;
-  map<int, vector<double> >::iterator iyy;
+  int iy;
   int imm;
   float year_avg;
   
-  for(iyy=mGlobalAverageMonthlyAnomalies.begin(); 
-      iyy!=mGlobalAverageMonthlyAnomalies.end(); iyy++)
+  for(iy=0; iy<mAnomalyNumYears; iy++)
   {
     year_avg=0;
     
     for(imm=0; imm<12; imm++)
     {
-      year_avg += iyy->second[imm];
+      year_avg += mGlobalAverageMonthlyAnomalies[12*iy+imm];
     }
 
     year_avg/=12;
 
-    cout << 1.*iyy->first << "," << year_avg << endl;
+    cout << 1.*(mAnomalyFirstYear+iy) << "," << year_avg << endl;
 
   }
 
@@ -102,74 +534,77 @@ void GHCN::DumpSmoothedResults() // MERGE_MODE mode)
 
 void GHCN::MergeMonthsToYear(MERGE_MODE mode)
 {
+  mGlobalAverageAnnualAnomalies.clear();
   
-  map<int, vector<double> >::iterator iyy;
+  int iy;
   int imm;
   float year_avg;
   float year_max;
   float year_min;
   
-  for(iyy=mGlobalAverageMonthlyAnomalies.begin(); 
-      iyy!=mGlobalAverageMonthlyAnomalies.end(); iyy++)
+  for(iy=0; iy<mAnomalyNumYears; iy++)
   {
+    const double *months=&mGlobalAverageMonthlyAnomalies[12*(size_t)iy];
+    int yy=mAnomalyFirstYear+iy;
+
     year_avg=0;
     year_max=0;
     year_min=0;
+
+    // The months with an average anomaly.
+    unsigned mask=0;
+    for(imm=0; imm<12; imm++)
+    {
+      mask|=(unsigned)(months[imm]>GHCN_NOTEMP()+ERR_EPS())<<imm;
+    }
     
-    int mm_avg_count=0;
+    int mm_avg_count=GHCNTempStore::CountMonths(mask);
     switch(mode)
     {
       case MERGE_AVG:
 	// Compute an average of all months for this year.
 	for(imm=0; imm<12; imm++)
 	{
-	  if(iyy->second[imm]>GHCN_NOTEMP()+ERR_EPS())
-	  {
-	    year_avg += iyy->second[imm];
-	    mm_avg_count+=1;
-	  }
+	  year_avg += ((mask>>imm)&1) ? months[imm] : 0.0;
 	}
 	// Add the value to the anomaly map only if it's
 	// a valid temperature value.
 	if(mm_avg_count>=1)
 	{
 	  year_avg/=mm_avg_count;
-	  mGlobalAverageAnnualAnomalies[iyy->first] = year_avg;
+	  mGlobalAverageAnnualAnomalies[yy] = year_avg;
 	}
 	break;
 	
       case MERGE_MAX:
 	// Use the maximum monthly anomaly for the year
 	// as this year's global anomaly.
-	year_max=iyy->second[0];
+	year_max=months[0];
 	for(imm=1; imm<12; imm++)
 	{
-	  year_max=MAX(year_max,iyy->second[imm]);
+	  year_max=MAX(year_max,months[imm]);
 	}
 	// Add the value to the anomaly map only if it's
 	// a valid temperature value.
 	if(year_max > GHCN_NOTEMP()+ERR_EPS())
 	{
-	  mGlobalAverageAnnualAnomalies[iyy->first] = year_max;
+	  mGlobalAverageAnnualAnomalies[yy] = year_max;
 	}
 	break;
 
       case MERGE_MIN:
 	// Use the minimum monthly anomaly for the year
 	// as this year's global anomaly.
-	year_min=iyy->second[0];
+	year_min=months[0];
 	for(imm=1; imm<12; imm++)
 	{
-	  if(iyy->second[imm]>GHCN_NOTEMP()+ERR_EPS())
-	  {
-	    year_min=MIN(year_min,iyy->second[imm]);
-	  }
+	  year_min = ((mask>>imm)&1) ? MIN(year_min,months[imm]) : year_min;
 	}
 	// Add the value to the anomaly map only if it's
 	// a valid temperature value.
 	if(year_min > GHCN_NOTEMP()+ERR_EPS())
 	{
-	  mGlobalAverageAnnualAnomalies[iyy->first] = year_min;
+	  mGlobalAverageAnnualAnomalies[yy] = year_min;
 	}
 	break;
     }
@@ -181,387 +616,1866 @@ void GHCN::MergeMonthsToYear(MERGE_MODE mode)
 }
 
 
-void GHCN::ComputeGlobalAverageAnomalies(const int& minBaselineSampleCount)
+bool GHCN::StationQualifies(const int *baselineCount, 
+                            int minBaselineSampleCount)
 {
-  
-  map<int, map<int, vector<float> > >::iterator iss; //station-id iterator
-  map<int, vector<float> >:: iterator iyy; // year iterator
-
-  int imm; // month index
-
-  for(iss=mTempsMap.begin(); iss!=mTempsMap.end(); iss++)
+  for(int imm=0; imm<12; imm++)
   {
-    for(iyy=iss->second.begin(); iyy!=iss->second.end(); iyy++)
+    if(baselineCount[imm]>=minBaselineSampleCount)
     {
-      if(mGlobalAverageMonthlyAnomalies[iyy->first].size() == 0)
-      {
-	mGlobalAverageMonthlyAnomalies[iyy->first].resize(12);
-	for(imm=0; imm<12; imm++)
-	{
-	  mGlobalAverageMonthlyAnomalies[iyy->first][imm]=0;
-	}
-      }
-      
-      for(imm=0; imm<12; imm++)
-      {
-	// Do we have a valid temperature sample?
-	if(iyy->second[imm]>GHCN_NOTEMP()+ERR_EPS())
-	{
-	  // Do we have enough baseline temperature samples to include
-	  // this station/month in the anomaly average?
-	  if(mBaselineSampleCount[iss->first][imm]>=minBaselineSampleCount)
-	  {
-	    if(mGlobalAverageMonthlyAnomalies.find(iyy->first)
-	       ==mGlobalAverageMonthlyAnomalies.end())  
-	    {
-	      // 1st element for this particular year and month?  Need
-	      // to create a new map entry.
-	      mGlobalAverageMonthlyAnomalies[iyy->first][imm] = 
-		iyy->second[imm]-mBaselineTemperature[iss->first][imm];
-	      mAverageStationCount[iyy->first][imm]=1;
-	    }
-	    else
-	    {
-	      // Station counter element already exists for year/month -- increment it.
-	      mGlobalAverageMonthlyAnomalies[iyy->first][imm] 
-		+= iyy->second[imm]-mBaselineTemperature[iss->first][imm];
-	      mAverageStationCount[iyy->first][imm]+=1;
-	    }
-	  }
-	}
-      }
+      return true;
     }
   }
+  return false;
+}
 
-  // Now have anomaly sums (summed over all qualifying stations) 
-  // for each year and month. Divide by the number of stations included 
-  // for each year and month to get the average anomaly  values.
-  map<int,vector<double> >::iterator avg_iyy;
-  for(avg_iyy=mGlobalAverageMonthlyAnomalies.begin(); 
-      avg_iyy!=mGlobalAverageMonthlyAnomalies.end(); avg_iyy++)
+void GHCN::CountStationsKept(int minBaselineSampleCount)
+{
+  int nstations=NumActiveStations();
+
+  mStationsKept=0;
+  for(int ii=0; ii<nstations; ii++)
   {
-    // Loop over months in a given year.
-    for(imm=0; imm<12; imm++)
+    int is=ActiveStation(ii);
+    if(StationQualifies(&mBaselineSampleCount[12*(size_t)is], 
+                        minBaselineSampleCount))
     {
-      if(mAverageStationCount[avg_iyy->first][imm]>=1)
-      {
-	avg_iyy->second[imm] /= mAverageStationCount[avg_iyy->first][imm];
-      }
-      else
-      {
-	// No station data found for this year/month?
-	// Then set to GHCN_NOTEMP so that this entry won't
-	// used to compute the annual anomaly temperatures.
-	avg_iyy->second[imm]=GHCN_NOTEMP();
-      }
+      mStationsKept++;
     }
-    
   }
-
-  return;
-  
+  mStationsDropped=nstations-mStationsKept;
 }
 
-// void GHCN::ComputeMovingAvg()
-// {
-//   ComputeMovingAvg(mIavgNyear);
-//   return;
-// }
-
-void GHCN::ComputeMovingAvg(const int& nel_in)
+void GHCN::StationAnomalies(const GHCNTempStore& store, int is,
+                            const int *baselineCount, const float *baseline,
+                            int minBaselineSampleCount, int firstYear,
+                            double *sum, int *count, int sign)
 {
-  map<int, double >::iterator iyy_init;
-  map<int, double >::iterator iyy_center;
-  map<int, double >::iterator iyy_leading;
-  map<int, double >::iterator iyy_trailing;
+  size_t iy0=store.FirstYear(is)-firstYear;
+  const uint16_t *masks=store.Masks(is);
 
-  int filt_halfwidth;
-  
-  double year_avg;
-  int icount;
-  int nel;
-  
-  nel=nel_in;
-  
-  if(nel%2==0)
+  // The months with enough baseline temperature samples to include
+  // this station in the anomaly average.
+  unsigned usable=0;
+  for(int imm=0; imm<12; imm++)
   {
-    // make sure nel is odd
-    cerr << endl;
-    cerr << "Moving average filter length incremented to " << nel+1 << endl;
-    cerr << "Moving average filter length must be odd. " << endl;
-    cerr << endl;
-    
-    nel+=1;
+    usable|=(unsigned)(baselineCount[imm]>=minBaselineSampleCount)<<imm;
   }
-  filt_halfwidth = nel/2;
-  
-  if(nel==1)
+  if(usable==0)
   {
-    // No smoothing -- Just do a straight copy and return.
-    for(iyy_init=mGlobalAverageAnnualAnomalies.begin(); 
-	iyy_init!=mGlobalAverageAnnualAnomalies.end(); iyy_init++)
+    return;
+  }
+
+  for(int iy=0; iy<store.NumYears(is); iy++)
+  {
+    // Months with a valid temperature sample as well.
+    unsigned mask=masks[iy]&usable;
+    if(mask==0)
     {
-      mSmoothedGlobalAverageAnnualAnomalies[iyy_init->first]=iyy_init->second;
+      continue;
+    }
+
+    const float *temps=store.Row(is,iy);
+    double *yearSum=&sum[12*(iy0+iy)];
+    int *yearCount=&count[12*(iy0+iy)];
+
+    for(int imm=0; imm<12; imm++)
+    {
+      unsigned valid=(mask>>imm)&1;
+      yearSum[imm] += valid ? sign*(temps[imm]-baseline[imm]) : 0.0f;
+      yearCount[imm] += sign*(int)valid;
     }
-    return;
   }
+}
 
-  icount=0;
+// Sum the anomalies of active stations [ii_begin,ii_end) into sums (which 
+// covers the whole anomaly year range).
+void GHCN::AccumulateAnomalies(int ii_begin, int ii_end,
+                               const int& minBaselineSampleCount,
+                               AnomalySums& sums)
+{
+  fill_n(sums.sum, 12*(size_t)mAnomalyNumYears, 0.0);
+  fill_n(sums.count, 12*(size_t)mAnomalyNumYears, 0);
 
-  iyy_trailing=mGlobalAverageAnnualAnomalies.begin();
-  iyy_init=iyy_trailing;
-  // This is ugly -- but it's the only way that I could
-  // get the iterator initialized to the moving-average
-  // window center.
-  iyy_center=mGlobalAverageAnnualAnomalies.begin();
-  for(icount=0; icount<filt_halfwidth; icount++)
+  for(int ii=ii_begin; ii<ii_end; ii++)
   {
-    iyy_center++;
+    int is=ActiveStation(ii);
+    StationAnomalies(mTemps, is, &mBaselineSampleCount[12*(size_t)is],
+                     &mBaselineTemperature[12*(size_t)is],
+                     minBaselineSampleCount, mAnomalyFirstYear,
+                     sums.sum, sums.count);
+  }
+}
+
+void GHCN::AddAnomalySums(AnomalySums& into, const AnomalySums& from,
+                          size_t n)
+{
+  for(size_t ii=0; ii<n; ii++)
+  {
+    into.sum[ii]+=from.sum[ii];
+    into.count[ii]+=from.count[ii];
+  }
+}
+
+void GHCN::AddAnomalySums(GridSums& into, const GridSums& from, size_t n)
+{
+  for(size_t ii=0; ii<n; ii++)
+  {
+    into.sum[ii]+=from.sum[ii];
+    into.weight[ii]+=from.weight[ii];
+    into.count[ii]+=from.count[ii];
+  }
+}
+
+template<class Sums>
+void GHCN::ReducePairwise(Sums *partial, int nblocks, size_t n)
+{
+  // Pairwise, always in the same tree order, so the totals don't 
+  // depend on the number of threads.
+  for(int stride=1; stride<nblocks; stride*=2)
+  {
+    int npairs=(nblocks+2*stride-1)/(2*stride);
+    GHCNParallelFor(npairs, mNumThreads, [&](int ip)
+    {
+      int ib=2*stride*ip;
+      if(ib+stride<nblocks)
+      {
+	AddAnomalySums(partial[ib], partial[ib+stride], n);
+      }
+    });
+  }
+}
+
+void GHCN::ComputeGriddedAnomalies(const int& minBaselineSampleCount)
+{
+  int nstations=NumActiveStations();
+  int ncells=mGrid->NumCells();
+  size_t nym=12*(size_t)mAnomalyNumYears;
+
+  // Bucket the stations by grid cell:  cellStations[cellStart[ic] ..
+  // cellStart[ic+1]) are the stations in cell ic, in station order.
+  // (stationCell is indexed by active-station position.)
+  int *stationCell=mScratch.AllocateFilled(nstations, -1);
+  int *cellStart=mScratch.AllocateFilled(ncells+1, 0);
+  mStationsUnlocated=0;
+  for(int ii=0; ii<nstations; ii++)
+  {
+    float lat, lon;
+    if(mInventory->Find(mTemps.StationId(ActiveStation(ii)), lat, lon))
+    {
+      stationCell[ii]=mGrid->Cell(lat, lon);
+      cellStart[stationCell[ii]+1]++;
+    }
+    else
+    {
+      mStationsUnlocated++;
+    }
+  }
+  for(int ic=0; ic<ncells; ic++)
+  {
+    cellStart[ic+1]+=cellStart[ic];
+  }
+  int *cellStations=mScratch.AllocateArray<int>(cellStart[ncells]);
+  int *cursor=mScratch.AllocateArray<int>(ncells);
+  copy(cellStart, cellStart+ncells, cursor);
+  for(int ii=0; ii<nstations; ii++)
+  {
+    if(stationCell[ii]>=0)
+    {
+      cellStations[cursor[stationCell[ii]]++]=ActiveStation(ii);
+    }
+  }
+
+  // Only the occupied cells need any work.
+  int *cells=mScratch.AllocateArray<int>(ncells);
+  int ncellsUsed=0;
+  for(int ic=0; ic<ncells; ic++)
+  {
+    if(cellStart[ic+1]>cellStart[ic])
+    {
+      cells[ncellsUsed++]=ic;
+    }
+  }
+  mGridCellsUsed=ncellsUsed;
+
+  // Each block of cells averages its stations' anomalies cell by cell,
+  // and sums the cell averages times the cell weights.
+  int nblocks=MAX(1,(ncellsUsed+CELL_BLOCK-1)/CELL_BLOCK);
+  GridSums *partial=mScratch.AllocateArray<GridSums>(nblocks);
+  double *cellSums=mScratch.AllocateArray<double>(nblocks*nym);
+  int *cellCounts=mScratch.AllocateArray<int>(nblocks*nym);
+  for(int ib=0; ib<nblocks; ib++)
+  {
+    partial[ib].sum=mScratch.AllocateArray<double>(nym);
+    partial[ib].weight=mScratch.AllocateArray<double>(nym);
+    partial[ib].count=mScratch.AllocateArray<int>(nym);
+  }
+  GHCNParallelFor(nblocks, mNumThreads, [&](int ib)
+  {
+    GridSums& sums=partial[ib];
+    fill_n(sums.sum, nym, 0.0);
+    fill_n(sums.weight, nym, 0.0);
+    fill_n(sums.count, nym, 0);
+
+    double *cellSum=cellSums+ib*nym;
+    int *cellCount=cellCounts+ib*nym;
+    int ii_end=MIN(ncellsUsed, (ib+1)*CELL_BLOCK);
+    for(int ii=ib*CELL_BLOCK; ii<ii_end; ii++)
+    {
+      int ic=cells[ii];
+      fill_n(cellSum, nym, 0.0);
+      fill_n(cellCount, nym, 0);
+
+      for(int jj=cellStart[ic]; jj<cellStart[ic+1]; jj++)
+      {
+	int is=cellStations[jj];
+	StationAnomalies(mTemps, is, &mBaselineSampleCount[12*(size_t)is],
+	                 &mBaselineTemperature[12*(size_t)is],
+	                 minBaselineSampleCount, mAnomalyFirstYear,
+	                 cellSum, cellCount);
+      }
+
+      double weight=mGrid->Weight(ic);
+      for(size_t iym=0; iym<nym; iym++)
+      {
+	if(cellCount[iym]>0)
+	{
+	  sums.sum[iym]+=weight*cellSum[iym]/cellCount[iym];
+	  sums.weight[iym]+=weight;
+	  sums.count[iym]+=cellCount[iym];
+	}
+      }
+    }
+  });
+
+  ReducePairwise(partial, nblocks, nym);
+
+  // Weighted average over the cells with data.
+  mAnomalySum.clear();
+  mAverageStationCount.assign(partial[0].count, partial[0].count+nym);
+  mGlobalAverageMonthlyAnomalies.resize(nym);
+  for(size_t iym=0; iym<nym; iym++)
+  {
+    if(partial[0].weight[iym]>0.0)
+    {
+      mGlobalAverageMonthlyAnomalies[iym]=
+	partial[0].sum[iym]/partial[0].weight[iym];
+    }
+    else
+    {
+      mGlobalAverageMonthlyAnomalies[iym]=GHCN_NOTEMP();
+    }
+  }
+}
+
+void GHCN::ComputeGlobalAverageAnomalies(const int& minBaselineSampleCount)
+{
+  int nstations=NumActiveStations();
+  int nblocks=MAX(1,(nstations+STATION_BLOCK-1)/STATION_BLOCK);
+  int lastYear;
+
+  // Year range covered by all the stations.
+  mAnomalyFirstYear=0;
+  lastYear=-1;
+  for(int ii=0; ii<nstations; ii++)
+  {
+    int is=ActiveStation(ii);
+    if(ii==0 || mTemps.FirstYear(is)<mAnomalyFirstYear)
+    {
+      mAnomalyFirstYear=mTemps.FirstYear(is);
+    }
+    lastYear=MAX(lastYear, mTemps.FirstYear(is)+mTemps.NumYears(is)-1);
+  }
+  mAnomalyNumYears=MAX(0,lastYear-mAnomalyFirstYear+1);
+
+  CountStationsKept(minBaselineSampleCount);
+  mStateMinBaselineSampleCount=minBaselineSampleCount;
+
+  mScratch.Reset();
+  if(mGrid!=NULL)
+  {
+    ComputeGriddedAnomalies(minBaselineSampleCount);
+    return;
+  }
+
+  // Every block of stations gets its own year x month sums...
+  size_t nym=12*(size_t)mAnomalyNumYears;
+  AnomalySums *partial=mScratch.AllocateArray<AnomalySums>(nblocks);
+  for(int ib=0; ib<nblocks; ib++)
+  {
+    partial[ib].sum=mScratch.AllocateArray<double>(nym);
+    partial[ib].count=mScratch.AllocateArray<int>(nym);
+  }
+  GHCNParallelFor(nblocks, mNumThreads, [&](int ib)
+  {
+    AccumulateAnomalies(ib*STATION_BLOCK, MIN(nstations,(ib+1)*STATION_BLOCK),
+                        minBaselineSampleCount, partial[ib]);
+  });
+
+  // ...which are then added up.
+  ReducePairwise(partial, nblocks, nym);
+
+  mAnomalySum.assign(partial[0].sum, partial[0].sum+nym);
+  mAverageStationCount.assign(partial[0].count, partial[0].count+nym);
+
+  AverageAnomalySums();
+
+  return;
+  
+}
+
+void GHCN::AverageAnomalySums(void)
+{
+  // Now have anomaly sums (summed over all qualifying stations) 
+  // for each year and month. Divide by the number of stations included 
+  // for each year and month to get the average anomaly  values.
+  mGlobalAverageMonthlyAnomalies.resize(mAnomalySum.size());
+  for(size_t iym=0; iym<mAnomalySum.size(); iym++)
+  {
+    if(mAverageStationCount[iym]>=1)
+    {
+      mGlobalAverageMonthlyAnomalies[iym] = 
+	mAnomalySum[iym]/mAverageStationCount[iym];
+    }
+    else
+    {
+      // No station data found for this year/month?
+      // Then set to GHCN_NOTEMP so that this entry won't
+      // used to compute the annual anomaly temperatures.
+      mGlobalAverageMonthlyAnomalies[iym]=GHCN_NOTEMP();
+    }
+  }
+}
+
+void GHCN::GrowAnomalyYears(int firstYear, int lastYear)
+{
+  if(mAnomalyNumYears==0)
+  {
+    mAnomalyFirstYear=firstYear;
+  }
+
+  if(firstYear<mAnomalyFirstYear)
+  {
+    size_t nnew=12*(size_t)(mAnomalyFirstYear-firstYear);
+    mAnomalySum.insert(mAnomalySum.begin(), nnew, 0.0);
+    mAverageStationCount.insert(mAverageStationCount.begin(), nnew, 0);
+    mAnomalyNumYears+=mAnomalyFirstYear-firstYear;
+    mAnomalyFirstYear=firstYear;
+  }
+
+  if(lastYear>=mAnomalyFirstYear+mAnomalyNumYears)
+  {
+    mAnomalyNumYears=lastYear-mAnomalyFirstYear+1;
+    mAnomalySum.resize(12*(size_t)mAnomalyNumYears, 0.0);
+    mAverageStationCount.resize(12*(size_t)mAnomalyNumYears, 0);
+  }
+}
+
+// void GHCN::ComputeMovingAvg()
+// {
+//   ComputeMovingAvg(mIavgNyear);
+//   return;
+// }
+
+void GHCN::ComputeMovingAvg(const int& nel_in)
+{
+  map<int, double >::iterator iyy_init;
+  map<int, double >::iterator iyy_center;
+  map<int, double >::iterator iyy_leading;
+  map<int, double >::iterator iyy_trailing;
+
+  int filt_halfwidth;
+  
+  double year_avg;
+  int icount;
+  int nel;
+  
+  nel=nel_in;
+
+  mSmoothedGlobalAverageAnnualAnomalies.clear();
+  
+  if(nel%2==0)
+  {
+    // make sure nel is odd
+    cerr << endl;
+    cerr << "Moving average filter length incremented to " << nel+1 << endl;
+    cerr << "Moving average filter length must be odd. " << endl;
+    cerr << endl;
+    
+    nel+=1;
+  }
+  filt_halfwidth = nel/2;
+
+  if(mGlobalAverageAnnualAnomalies.size() < (size_t)nel)
+  {
+    // Not even one full filter window of data -- nothing to output.
+    return;
+  }
+  
+  if(nel==1)
+  {
+    // No smoothing -- Just do a straight copy and return.
+    for(iyy_init=mGlobalAverageAnnualAnomalies.begin(); 
+	iyy_init!=mGlobalAverageAnnualAnomalies.end(); iyy_init++)
+    {
+      mSmoothedGlobalAverageAnnualAnomalies[iyy_init->first]=iyy_init->second;
+    }
+    return;
+  }
+
+  icount=0;
+
+  iyy_trailing=mGlobalAverageAnnualAnomalies.begin();
+  iyy_init=iyy_trailing;
+  // This is ugly -- but it's the only way that I could
+  // get the iterator initialized to the moving-average
+  // window center.
+  iyy_center=mGlobalAverageAnnualAnomalies.begin();
+  for(icount=0; icount<filt_halfwidth; icount++)
+  {
+    iyy_center++;
+  }
+
+  // Initialize the moving-average window sum...
+  year_avg=0;
+  iyy_leading=mGlobalAverageAnnualAnomalies.begin();
+  for(icount=0; icount<nel; icount++)
+  {
+    year_avg+=iyy_leading->second/nel;
+    iyy_leading++;
+  }
+  mSmoothedGlobalAverageAnnualAnomalies[iyy_center->first] = year_avg;
+
+  iyy_center++;
+  iyy_trailing++;
+//   iyy_leading++;
+  
+  // Got the moving average started up -- walk through the remaining
+  // data, adding the leading value and subtracting the trailing
+  // value for each new moving-average output.
+  while(iyy_leading != mGlobalAverageAnnualAnomalies.end())
+  {
+      year_avg += 1.*(iyy_leading->second-iyy_trailing->second)/nel;
+      mSmoothedGlobalAverageAnnualAnomalies[iyy_center->first] = year_avg;
+
+      iyy_center++;
+      iyy_leading++;
+      iyy_trailing++;
+  }
+
+  return;
+  
+}
+
+
+void GHCN::StationBaseline(const GHCNTempStore& store, int is,
+                           int firstYear, int lastYear,
+                           int *count, float *baseline)
+{
+  // Summed in double, which holds any realistic sum of these floats
+  // exactly, so the baselines don't depend on the order of the sums
+  // and match the ones from the running totals.
+  double sum[12];
+  for(int imm=0; imm<12; imm++)
+  {
+    count[imm]=0;
+    sum[imm]=0.0;
+  }
+
+  // Loop through the station's years in the temperature baseline 
+  // period.
+  int iy_begin=MAX(0, firstYear-store.FirstYear(is));
+  int iy_end=MIN(store.NumYears(is), lastYear+1-store.FirstYear(is));
+  const uint16_t *masks=store.Masks(is);
+  for(int iy=iy_begin; iy<iy_end; iy++)
+  {
+    const float *temps=store.Row(is,iy);
+    unsigned mask=masks[iy];
+
+    // Sum up the valid baseline temperatures (the ones with their
+    // mask bit set) and count them for this station and month.  
+    // Missing ones add nothing.
+    for(int imm=0; imm<12; imm++)
+    {
+      unsigned valid=(mask>>imm)&1;
+      sum[imm]+=valid ? temps[imm] : 0.0f;
+      count[imm]+=valid;
+    }
+  }
+
+  // Divide each baseline temperature sum by the number of valid samples 
+  // found in the baseline time-period to get the baseline average 
+  // temperature for this station and month.
+  for(int imm=0; imm<12; imm++)
+  {
+    baseline[imm]=(float)sum[imm];
+    if(count[imm]>1)
+    {
+      baseline[imm] /= count[imm];
+    }
+  }
+}
+
+void GHCN::ComputeBaselines(void)
+{
+  int nstations=mTemps.NumStations();
+  int nblocks=(nstations+STATION_BLOCK-1)/STATION_BLOCK;
+  pair<int,int> window(mFirstBaselineYear, mLastBaselineYear);
+
+  if(mbBaselinesValid && mBaselineWindow==window)
+  {
+    return;
+  }
+
+  // Hang onto the baselines for the window we had, and reuse any we 
+  // already have for the new one.
+  if(mbBaselinesValid)
+  {
+    BaselineSet& old=mBaselineCache[mBaselineWindow];
+    old.count.swap(mBaselineSampleCount);
+    old.temperature.swap(mBaselineTemperature);
+  }
+  mBaselineWindow=window;
+  mbBaselinesValid=true;
+
+  map<pair<int,int>,BaselineSet>::iterator cached=mBaselineCache.find(window);
+  if(cached!=mBaselineCache.end())
+  {
+    mBaselineSampleCount.swap(cached->second.count);
+    mBaselineTemperature.swap(cached->second.temperature);
+    mBaselineCache.erase(cached);
+    return;
+  }
+
+  // More than one window:  worth a pass over all the years to make 
+  // every window after this one cheap.
+  bool usePrefix=!mBaselineCache.empty();
+  if(usePrefix && mPrefixStart.empty())
+  {
+    BuildBaselinePrefixSums();
+  }
+
+  // One slot per station and month, written only by the thread that
+  // owns the station's block.
+  mBaselineSampleCount.resize(12*(size_t)nstations);
+  mBaselineTemperature.resize(12*(size_t)nstations);
+
+  GHCNParallelFor(nblocks, mNumThreads, [&](int ib)
+  {
+    int is_end=MIN(nstations, (ib+1)*STATION_BLOCK);
+
+    for(int is=ib*STATION_BLOCK; is<is_end; is++)
+    {
+      if(usePrefix)
+      {
+	PrefixBaseline(is, mFirstBaselineYear, mLastBaselineYear,
+		       &mBaselineSampleCount[12*(size_t)is],
+		       &mBaselineTemperature[12*(size_t)is]);
+      }
+      else
+      {
+	StationBaseline(mTemps, is, mFirstBaselineYear, mLastBaselineYear,
+			&mBaselineSampleCount[12*(size_t)is],
+			&mBaselineTemperature[12*(size_t)is]);
+      }
+    }
+  });
+}
+
+void GHCN::BuildBaselinePrefixSums(void)
+{
+  int nstations=mTemps.NumStations();
+  int nblocks=(nstations+STATION_BLOCK-1)/STATION_BLOCK;
+
+  mPrefixStart.resize(nstations);
+  size_t nentries=0;
+  for(int is=0; is<nstations; is++)
+  {
+    mPrefixStart[is]=nentries;
+    nentries+=mTemps.NumYears(is)+1;
+  }
+  mPrefixSum.resize(12*nentries);
+  mPrefixCount.resize(12*nentries);
+
+  GHCNParallelFor(nblocks, mNumThreads, [&](int ib)
+  {
+    int is_end=MIN(nstations, (ib+1)*STATION_BLOCK);
+
+    for(int is=ib*STATION_BLOCK; is<is_end; is++)
+    {
+      double *sum=&mPrefixSum[12*mPrefixStart[is]];
+      int *count=&mPrefixCount[12*mPrefixStart[is]];
+
+      for(int imm=0; imm<12; imm++)
+      {
+	sum[imm]=0.0;
+	count[imm]=0;
+      }
+      const uint16_t *masks=mTemps.Masks(is);
+      for(int iy=0; iy<mTemps.NumYears(is); iy++)
+      {
+	const float *temps=mTemps.Row(is,iy);
+	for(int imm=0; imm<12; imm++)
+	{
+	  unsigned valid=(masks[iy]>>imm)&1;
+	  sum[12+imm]=sum[imm]+(valid ? temps[imm] : 0.0);
+	  count[12+imm]=count[imm]+valid;
+	}
+	sum+=12;
+	count+=12;
+      }
+    }
+  });
+}
+
+void GHCN::PrefixBaseline(int is, int firstYear, int lastYear,
+                          int *count, float *baseline) const
+{
+  // The window's years, as entries of the station's running totals.
+  int ny=mTemps.NumYears(is);
+  int k0=MAX(0, MIN(ny, firstYear-mTemps.FirstYear(is)));
+  int k1=MAX(k0, MIN(ny, lastYear+1-mTemps.FirstYear(is)));
+  const double *sum=&mPrefixSum[12*mPrefixStart[is]];
+  const int *num=&mPrefixCount[12*mPrefixStart[is]];
+
+  for(int imm=0; imm<12; imm++)
+  {
+    count[imm]=num[12*k1+imm]-num[12*k0+imm];
+    baseline[imm]=(float)(sum[12*k1+imm]-sum[12*k0+imm]);
+    if(count[imm]>1)
+    {
+      baseline[imm] /= count[imm];
+    }
+  }
+}
+
+void GHCN::SetStationSubset(const vector<int>& stations)
+{
+  mSubset=stations;
+  mbUseSubset=true;
+  mStationsFilteredOut=mTemps.NumStations()-(int)mSubset.size();
+}
+
+void GHCN::ClearStationSubset(void)
+{
+  mSubset.clear();
+  mbUseSubset=false;
+  mStationsFilteredOut=0;
+}
+
+template<class Sink>
+void GHCN::ParseLines(const char *begin, const char *end, 
+                      ParseCounts& counts, Sink sink)
+{
+  switch(mFormat)
+  {
+    case GHCN_FORMAT_V3:
+      ParseLayout<GHCNLayoutV3>(begin, end, counts, sink);
+      break;
+    case GHCN_FORMAT_V4:
+      ParseLayout<GHCNLayoutV4>(begin, end, counts, sink);
+      break;
+    case GHCN_FORMAT_DAILY:
+      ParseDaily(begin, end, counts, sink);
+      break;
+    default:
+      ParseLayout<GHCNLayoutV2>(begin, end, counts, sink);
+      break;
+  }
+}
+
+template<class Layout, class Sink>
+void GHCN::ParseLayout(const char *begin, const char *end, 
+                       ParseCounts& counts, Sink sink)
+{
+  const char *line;
+  const char *eol;
+  int len;
+  GHCNStationKey station;
+  int tt[12];
+  float temps[12];
+  int yy;
+  int ii;
+
+  // Only v2 lines have the packed 5-character fields the SIMD parser 
+  // reads.
+  const bool packedFields=(Layout::FIELD_WIDTH==Layout::VALUE_WIDTH);
+  const bool dropFlagged=(Layout::QCFLAG_OFFSET>=0 && mbDropQcFlagged);
+
+  for(line=begin; line<end; line=eol+1)
+  {
+    eol=(const char*)memchr(line, '\n', end-line);
+    if(eol==NULL)
+    {
+      // Last line with no trailing newline.
+      eol=end;
+    }
+    counts.lines++;
+
+    len=(int)(eol-line);
+    if(len>0 && line[len-1]=='\r')
+    {
+      len--;
+    }
+
+    // Need at least the station ID and year; skip anything shorter
+    // (blank lines etc.)
+    if(len<Layout::TEMPS_COL 
+       || !Layout::ParseStation(line, station)
+       || !GHCNParseFixedInt(line+Layout::YEAR_COL, 4, yy))
+    {
+      counts.malformed++;
+      continue;
+    }
+
+    if(yy >= MIN_GISS_YEAR)
+    {
+      // Fast path for a full-length line of well-formed fields;
+      // otherwise go field by field.
+      if(!packedFields || len<Layout::LINE_LEN 
+	 || !GHCNParseTemps12(line+Layout::TEMPS_COL, tt))
+      {
+	for(ii=0; ii<12; ii++)
+	{
+	  // Fields that are blank or beyond the end of a short line
+	  // are treated as missing.
+	  int col=Layout::TEMPS_COL+ii*Layout::FIELD_WIDTH;
+	  if(col+Layout::VALUE_WIDTH>len 
+	     || !GHCNParseFixedInt(line+col, Layout::VALUE_WIDTH, tt[ii]))
+	  {
+	    tt[ii]=GHCN_NOTEMP();
+	  }
+	  else if(dropFlagged && col+Layout::QCFLAG_OFFSET<len
+		  && line[col+Layout::QCFLAG_OFFSET]!=' '
+		  && tt[ii]>GHCN_NOTEMP()+ERR_EPS())
+	  {
+	    // Failed a quality check:  treat it as missing.
+	    tt[ii]=GHCN_NOTEMP();
+	    counts.qcFlagged++;
+	  }
+	}
+      }
+
+      for(ii=0; ii<12; ii++)
+      {
+	if(tt[ii]>GHCN_NOTEMP()+ERR_EPS())
+	{
+	  // Got a valid value? Divide the GHCN temperature*10
+	  // (*100 for v3/v4) number down to get the proper 
+	  // temperature value.
+	  temps[ii]=tt[ii]/(double)Layout::UNITS_PER_DEGREE;
+	}
+	else
+	{
+	  // Make sure missing temperature values are marked
+	  // by -9999 entries in the station/year/month temperature store.
+	  temps[ii]=GHCN_NOTEMP();
+	}
+      }
+
+      sink(station, yy, temps);
+      counts.records++;
+    }
+    else
+    {
+      counts.rejectedYear++;
+    }
+  }
+}
+
+template<class Sink>
+void GHCN::ParseDaily(const char *begin, const char *end, 
+                      ParseCounts& counts, Sink sink)
+{
+  typedef GHCNLayoutDaily Layout;
+
+  const char *element=DailyElementName(mDailyElement);
+  const char *line;
+  const char *eol;
+  int len;
+  GHCNStationKey lineStation;
+  int lineYear;
+  int month;
+
+  // The station-year being put together.
+  bool pending=false;
+  GHCNStationKey station=0;
+  int year=0;
+  float temps[12];
+
+  auto flushStationYear=[&]()
+  {
+    if(!pending)
+    {
+      return;
+    }
+    if(year >= MIN_GISS_YEAR)
+    {
+      sink(station, year, temps);
+      counts.records++;
+    }
+    else
+    {
+      counts.rejectedYear++;
+    }
+    pending=false;
+  };
+
+  for(line=begin; line<end; line=eol+1)
+  {
+    eol=(const char*)memchr(line, '\n', end-line);
+    if(eol==NULL)
+    {
+      eol=end;
+    }
+    counts.lines++;
+
+    len=(int)(eol-line);
+    if(len>0 && line[len-1]=='\r')
+    {
+      len--;
+    }
+
+    if(len<Layout::DAYS_COL
+       || !Layout::ParseStation(line, lineStation)
+       || !GHCNParseFixedInt(line+Layout::YEAR_COL, 4, lineYear)
+       || !GHCNParseFixedInt(line+Layout::MONTH_COL, 2, month)
+       || month<1 || month>12)
+    {
+      counts.malformed++;
+      continue;
+    }
+
+    // Skip the other elements (PRCP, SNOW...).
+    if(memcmp(line+Layout::ELEMENT_COL, element, 4)!=0)
+    {
+      continue;
+    }
+
+    if(pending && (lineStation!=station || lineYear!=year))
+    {
+      flushStationYear();
+    }
+    if(!pending)
+    {
+      station=lineStation;
+      year=lineYear;
+      for(int imm=0; imm<12; imm++)
+      {
+	temps[imm]=GHCN_NOTEMP();
+      }
+      pending=true;
+    }
+    if(year < MIN_GISS_YEAR)
+    {
+      continue;
+    }
+
+    // Monthly mean of the days that have a value (and, unless they're
+    // being kept, no QC flag).
+    int sum=0;
+    int ndays=0;
+    for(int iday=0; iday<Layout::NUM_DAYS; iday++)
+    {
+      int col=Layout::DAYS_COL+iday*Layout::FIELD_WIDTH;
+      int tt;
+      if(col+Layout::VALUE_WIDTH>len
+	 || !GHCNParseFixedInt(line+col, Layout::VALUE_WIDTH, tt)
+	 || tt<=GHCN_NOTEMP()+ERR_EPS())
+      {
+	continue;
+      }
+      if(mbDropQcFlagged && col+Layout::QCFLAG_OFFSET<len
+	 && line[col+Layout::QCFLAG_OFFSET]!=' ')
+      {
+	counts.qcFlagged++;
+	continue;
+      }
+      sum+=tt;
+      ndays++;
+    }
+
+    if(ndays>0 && ndays>=mMinDaysPerMonth)
+    {
+      temps[month-1]=sum/(double)(ndays*Layout::UNITS_PER_DEGREE);
+    }
+    else
+    {
+      temps[month-1]=GHCN_NOTEMP();
+    }
+  }
+
+  flushStationYear();
+}
+
+const char* GHCN::StationYearStart(const char *pp, const char *begin,
+                                   const char *end) const
+{
+  const int nn=GHCNLayoutDaily::STATION_YEAR_LEN;
+
+  if(mFormat!=GHCN_FORMAT_DAILY || pp<=begin || pp>=end)
+  {
+    return pp;
+  }
+
+  // Start of the line before pp.
+  const char *prev=pp-1;
+  while(prev>begin && prev[-1]!='\n')
+  {
+    prev--;
+  }
+  if(pp-prev<=nn)
+  {
+    return pp;
+  }
+
+  while(end-pp>nn && memcmp(pp, prev, nn)==0)
+  {
+    const char *eol=(const char*)memchr(pp, '\n', end-pp);
+    pp = (eol!=NULL) ? eol+1 : end;
+  }
+  return pp;
+}
+
+const char* GHCN::LastStationYearStart(const char *begin, 
+                                       const char *end) const
+{
+  const int nn=GHCNLayoutDaily::STATION_YEAR_LEN;
+
+  if(mFormat!=GHCN_FORMAT_DAILY)
+  {
+    return end;
+  }
+
+  // Start of the last line.
+  const char *last=end;
+  if(last>begin && last[-1]=='\n')
+  {
+    last--;
+  }
+  while(last>begin && last[-1]!='\n')
+  {
+    last--;
+  }
+  if(end-last<=nn)
+  {
+    return end;
+  }
+
+  // Back over the lines before it from the same station-year.
+  const char *start=last;
+  while(start>begin)
+  {
+    const char *prev=start-1;
+    while(prev>begin && prev[-1]!='\n')
+    {
+      prev--;
+    }
+    if(start-prev<=nn || memcmp(prev, last, nn)!=0)
+    {
+      break;
+    }
+    start=prev;
+  }
+  return start;
+}
+
+template<class Parse>
+void GHCN::ParseDecompressed(Parse parse)
+{
+  const int nn=GHCNLayoutDaily::STATION_YEAR_LEN;
+  const char *begin, *end;
+
+  // A daily station-year has to reach the parser in one piece, so the
+  // one at the end of each block is held back until the next block
+  // shows where it ends.
+  string carry;
+  while(mDecompressor.NextBlock(begin, end))
+  {
+    const char *head=begin;
+    if(!carry.empty())
+    {
+      while(end-head>nn && memcmp(head, carry.data(), nn)==0)
+      {
+	const char *eol=(const char*)memchr(head, '\n', end-head);
+	head = (eol!=NULL) ? eol+1 : end;
+      }
+      carry.append(begin, head);
+      if(head==end)
+      {
+	continue;
+      }
+      parse(carry.data(), carry.data()+carry.size());
+      carry.clear();
+    }
+
+    const char *tail=MAX(head, LastStationYearStart(begin, end));
+    parse(head, tail);
+    carry.assign(tail, end);
+  }
+  if(!carry.empty())
+  {
+    parse(carry.data(), carry.data()+carry.size());
+  }
+
+  CloseStream();
+  if(!mDecompressor.Error().empty())
+  {
+    cerr << mInputName << ": " << mDecompressor.Error() << endl;
+    exit(1);
+  }
+}
+
+const char* GHCN::DailyElementName(DAILY_ELEMENT element)
+{
+  switch(element)
+  {
+    case DAILY_TMAX:
+      return "TMAX";
+    case DAILY_TMIN:
+      return "TMIN";
+    default:
+      return "TAVG";
+  }
+}
+
+void GHCN::AddCounts(ParseCounts& into, const ParseCounts& from)
+{
+  into.lines+=from.lines;
+  into.records+=from.records;
+  into.rejectedYear+=from.rejectedYear;
+  into.malformed+=from.malformed;
+  into.qcFlagged+=from.qcFlagged;
+}
+
+void GHCN::ParseRecords(const char *begin, const char *end,
+                        GHCNTempStore& store, ParseCounts& counts)
+{
+  ParseLines(begin, end, counts, 
+             [&](GHCNStationKey station, int year, const float *temps)
+  {
+    store.AddRecord(station, year, temps);
+  });
+}
+
+void GHCN::ParseDailyFiles(size_t first, size_t last, GHCNTempStore& store,
+                           ParseCounts& counts)
+{
+  for(size_t ifile=first; ifile<last; ifile++)
+  {
+    GHCNMappedFile file;
+    if(!file.Open(mDailyFiles[ifile].c_str()))
+    {
+      cerr << "Can't read " << mDailyFiles[ifile] << endl;
+      continue;
+    }
+    ParseDaily(file.Data(), file.Data()+file.Size(), counts,
+               [&](GHCNStationKey station, int year, const float *temps)
+    {
+      store.AddRecord(station, year, temps);
+    });
+  }
+}
+
+void GHCN::ReadDailyFiles(void)
+{
+  // Contiguous runs of files are parsed in parallel, each into its own
+  // store, and the stores appended in file order, as ReadTemps() does
+  // with the chunks of one big file.  Several runs per thread even out
+  // the files' different sizes.
+  size_t nfiles=mDailyFiles.size();
+  int nruns=(int)MIN(nfiles, (size_t)(mNumThreads>1 ? 4*mNumThreads : 1));
+
+  vector<GHCNTempStore> partial(nruns);
+  vector<ParseCounts> partialCounts(nruns, ParseCounts());
+  GHCNParallelFor(nruns, mNumThreads, [&](int ir)
+  {
+    ParseDailyFiles(nfiles*ir/nruns, nfiles*(ir+1)/nruns, 
+                    partial[ir], partialCounts[ir]);
+    partial[ir].Finalize();
+  });
+
+  for(int ir=0; ir<nruns; ir++)
+  {
+    mTemps.Append(partial[ir]);
+    partial[ir].Clear();
+    AddCounts(mCounts, partialCounts[ir]);
+  }
+  mTemps.Finalize();
+}
+
+// A scratch name next to path to write a file under before renaming
+// it into place.  The process id keeps runs sharing a cache directory
+// apart, and the count keeps threads in one run apart.
+static string ScratchPath(const string& path)
+{
+  static atomic<unsigned> count(0);
+  ostringstream tmpPath;
+  tmpPath << path << ".tmp" << (long)getpid() << "." << count++;
+  return tmpPath.str();
+}
+
+string GHCN::CachePath(uint64_t sourceHash)
+{
+  // Snapshots parsed with different settings live side by side.
+  char name[40];
+  snprintf(name, sizeof(name), "%016llx.%d.gcache", 
+           (unsigned long long)sourceHash, (int)CacheParseFlags());
+  return mCacheDir + "/" + name;
+}
+
+bool GHCN::LoadCache(const string& path, uint64_t sourceHash, 
+                     uint64_t sourceSize)
+{
+  GHCNMappedFile cache;
+  CacheHeader hdr;
+
+  if(!cache.Open(path.c_str()) || cache.Size()<sizeof(hdr))
+  {
+    return false;
+  }
+  memcpy(&hdr, cache.Data(), sizeof(hdr));
+
+  if(memcmp(hdr.magic, "GHCNSTOR", 8)!=0 
+     || hdr.version!=CACHE_VERSION 
+     || hdr.byteOrder!=0x01020304
+     || hdr.sourceHash!=sourceHash 
+     || hdr.sourceSize!=sourceSize
+     || hdr.minYear!=MIN_GISS_YEAR
+     || hdr.parseFlags!=CacheParseFlags())
+  {
+    return false;
+  }
+
+  mCounts=hdr.counts;
+  return mTemps.Read(cache.Data()+sizeof(hdr), cache.Size()-sizeof(hdr));
+}
+
+void GHCN::SaveCache(const string& path, uint64_t sourceHash,
+                     uint64_t sourceSize)
+{
+  CacheHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, "GHCNSTOR", 8);
+  hdr.version=CACHE_VERSION;
+  hdr.byteOrder=0x01020304;
+  hdr.sourceHash=sourceHash;
+  hdr.sourceSize=sourceSize;
+  hdr.minYear=MIN_GISS_YEAR;
+  hdr.parseFlags=CacheParseFlags();
+  hdr.counts=mCounts;
+
+  // Write to a scratch name and rename it into place, so that a reader
+  // (or another run writing the same snapshot) never sees half a file.
+  string tmpPath=ScratchPath(path);
+
+  FILE *fp=fopen(tmpPath.c_str(), "wb");
+  bool ok = fp!=NULL 
+    && fwrite(&hdr, sizeof(hdr), 1, fp)==1 
+    && mTemps.Write(fp);
+  if(fp!=NULL)
+  {
+    ok = (fclose(fp)==0) && ok;
+  }
+  remove(path.c_str());
+  if(!ok || rename(tmpPath.c_str(), path.c_str())!=0)
+  {
+    remove(tmpPath.c_str());
+    cerr << "Couldn't write cache file " << path << endl;
+  }
+}
+
+void GHCN::StreamTemps(const int& minBaselineSampleCount)
+{
+  // How much of the file to get through between dropping the pages
+  // we've finished with.
+  static const size_t DROP_BYTES=64<<20;
+
+  const char *data=mInputFile.Data();
+  const char *end=data+mInputFile.Size();
+  GHCNTempStore station;
+  GHCNTempStore combined;
+  bool combine=(mDuplicateMode==DUPLICATES_COMBINE);
+  int count[12];
+  float baseline[12];
+  set<GHCNStationKey> doneStations;
+  int nrepeats=0;
+
+  // The anomaly sums grow as later years turn up.  Nothing before
+  // MIN_GISS_YEAR is ever kept.
+  mAnomalyFirstYear=MIN_GISS_YEAR;
+  mAnomalyNumYears=0;
+  mAnomalySum.clear();
+  mAverageStationCount.clear();
+
+  // Fold the buffered station (all its duplicates, when combining them)
+  // into the anomaly sums, then forget it.
+  auto flushStation=[&]()
+  {
+    if(station.NumStations()==0)
+    {
+      return;
+    }
+    station.Finalize();
+    if(combine)
+    {
+      CombineDuplicates(station, combined);
+    }
+    const GHCNTempStore& one = combine ? combined : station;
+
+    if(HasFilter() && !StationSelected(one.StationId(0)))
+    {
+      mStationsFilteredOut++;
+      station.Reset();
+      return;
+    }
+
+    if(!doneStations.insert(one.StationId(0)).second)
+    {
+      nrepeats++;
+    }
+
+    int nyears=one.FirstYear(0)+one.NumYears(0)-mAnomalyFirstYear;
+    if(nyears>mAnomalyNumYears)
+    {
+      mAnomalyNumYears=nyears;
+      mAnomalySum.resize(12*(size_t)nyears, 0.0);
+      mAverageStationCount.resize(12*(size_t)nyears, 0);
+    }
+
+    StationBaseline(one, 0, mFirstBaselineYear, mLastBaselineYear, 
+                    count, baseline);
+    if(StationQualifies(count, minBaselineSampleCount))
+    {
+      mStationsKept++;
+    }
+    else
+    {
+      mStationsDropped++;
+    }
+    StationAnomalies(one, 0, count, baseline, minBaselineSampleCount,
+                     mAnomalyFirstYear, mAnomalySum.data(),
+                     mAverageStationCount.data());
+    station.Reset();
+  };
+
+  // Buffer each station-year, flushing the buffered station when the
+  // next one starts.
+  auto addRecord=[&](GHCNStationKey key, int yy, const float *temps)
+  {
+    if(station.NumStations()>0 
+       && (combine ? GHCNStationGroup(key)!=GHCNStationGroup(station.StationId(0))
+	           : key!=station.StationId(0)))
+    {
+      flushStation();
+    }
+    station.AddRecord(key, yy, temps);
+  };
+
+  if(!mDailyFiles.empty())
+  {
+    // A batch of .dly files at a time is parsed in parallel (into
+    // monthly records), then the batch is fed through in file order.
+    size_t batch=16*(size_t)mNumThreads;
+    for(size_t first=0; first<mDailyFiles.size(); first+=batch)
+    {
+      int nb=(int)MIN(batch, mDailyFiles.size()-first);
+      vector<GHCNTempStore> parsed(nb);
+      vector<ParseCounts> parsedCounts(nb, ParseCounts());
+      GHCNParallelFor(nb, mNumThreads, [&](int ib)
+      {
+	ParseDailyFiles(first+ib, first+ib+1, parsed[ib], parsedCounts[ib]);
+	parsed[ib].Finalize();
+      });
+
+      for(int ib=0; ib<nb; ib++)
+      {
+	AddCounts(mCounts, parsedCounts[ib]);
+	for(int is=0; is<parsed[ib].NumStations(); is++)
+	{
+	  for(int iy=0; iy<parsed[ib].NumYears(is); iy++)
+	  {
+	    if(parsed[ib].IsPresent(is, iy))
+	    {
+	      addRecord(parsed[ib].StationId(is), parsed[ib].FirstYear(is)+iy,
+			parsed[ib].Row(is, iy));
+	    }
+	  }
+	}
+      }
+    }
   }
 
-  // Initialize the moving-average window sum...
-  year_avg=0;
-  iyy_leading=mGlobalAverageAnnualAnomalies.begin();
-  for(icount=0; icount<nel; icount++)
+  if(mbReadInBlocks)
   {
-    year_avg+=iyy_leading->second/nel;
-    iyy_leading++;
+    ParseDecompressed([&](const char *begin, const char *end)
+    {
+      ParseLines(begin, end, mCounts, addRecord);
+    });
   }
-  mSmoothedGlobalAverageAnnualAnomalies[iyy_center->first] = year_avg;
-
-  iyy_center++;
-  iyy_trailing++;
-//   iyy_leading++;
-  
-  // Got the moving average started up -- walk through the remaining
-  // data, adding the leading value and subtracting the trailing
-  // value for each new moving-average output.
-  while(iyy_leading != mGlobalAverageAnnualAnomalies.end())
+  else
   {
-      year_avg += 1.*(iyy_leading->second-iyy_trailing->second)/nel;
-      mSmoothedGlobalAverageAnnualAnomalies[iyy_center->first] = year_avg;
+    const char *chunk=data;
+    while(chunk<end)
+    {
+      // Work through the file DROP_BYTES at a time (to the next line end).
+      const char *chunk_end=end;
+      if((size_t)(end-chunk)>DROP_BYTES)
+      {
+	const char *eol=(const char*)memchr(chunk+DROP_BYTES, '\n', 
+					    end-(chunk+DROP_BYTES));
+	chunk_end=StationYearStart((eol!=NULL) ? eol+1 : end, data, end);
+      }
 
-      iyy_center++;
-      iyy_leading++;
-      iyy_trailing++;
+      ParseLines(chunk, chunk_end, mCounts, addRecord);
+
+      mInputFile.DropPages(chunk_end-data);
+      chunk=chunk_end;
+    }
   }
+  flushStation();
 
-  return;
-  
+  mInputFile.Close();
+
+  if(nrepeats>0)
+  {
+    cerr << "Warning: " << nrepeats << " stations turned up again after "
+	 << "other stations (input not sorted by station?);" << endl
+	 << "         each later run was treated as a separate station." << endl;
+  }
+
+  AverageAnomalySums();
 }
 
+bool GHCN::SaveState(const string& path) const
+{
+  StateHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, "GHCNSTAT", 8);
+  hdr.version=STATE_VERSION;
+  hdr.byteOrder=0x01020304;
+  hdr.minYear=MIN_GISS_YEAR;
+  hdr.firstBaselineYear=mFirstBaselineYear;
+  hdr.lastBaselineYear=mLastBaselineYear;
+  hdr.minBaselineSampleCount=mStateMinBaselineSampleCount;
+  hdr.duplicateMode=mDuplicateMode;
+  hdr.anomalyFirstYear=mAnomalyFirstYear;
+  hdr.anomalyNumYears=mAnomalyNumYears;
+
+  // Write the store first so we know how big its image is.
+  string tmpPath=ScratchPath(path);
+  FILE *fp=fopen(tmpPath.c_str(), "wb");
+  bool ok = fp!=NULL
+    && fwrite(&hdr, sizeof(hdr), 1, fp)==1
+    && mTemps.Write(fp);
+  if(ok)
+  {
+    long pos=ftell(fp);
+    hdr.storeBytes=(uint64_t)(pos-(long)sizeof(hdr));
+    ok = pos>=0
+      && WritePadded(fp, mBaselineSampleCount.data(), 
+                     mBaselineSampleCount.size()*sizeof(int))
+      && WritePadded(fp, mBaselineTemperature.data(), 
+                     mBaselineTemperature.size()*sizeof(float))
+      && WritePadded(fp, mAnomalySum.data(), mAnomalySum.size()*sizeof(double))
+      && WritePadded(fp, mAverageStationCount.data(), 
+                     mAverageStationCount.size()*sizeof(int))
+      && fseek(fp, 0, SEEK_SET)==0
+      && fwrite(&hdr, sizeof(hdr), 1, fp)==1;
+  }
+  if(fp!=NULL)
+  {
+    ok = (fclose(fp)==0) && ok;
+  }
+  remove(path.c_str());
+  if(!ok || rename(tmpPath.c_str(), path.c_str())!=0)
+  {
+    remove(tmpPath.c_str());
+    cerr << "Couldn't write state file " << path << endl;
+    return false;
+  }
+  return true;
+}
 
-void GHCN::ComputeBaselines(void)
+bool GHCN::LoadState(const string& path, const int& minBaselineSampleCount)
 {
+  GHCNMappedFile state;
+  StateHeader hdr;
 
-  int yykey;
-  
-  map<int, map<int, vector<float> > >::iterator iss;
-  int imm;
+  if(!state.Open(path.c_str()) || state.Size()<sizeof(hdr))
+  {
+    cerr << "Can't read state file " << path << endl;
+    return false;
+  }
+  memcpy(&hdr, state.Data(), sizeof(hdr));
+
+  if(memcmp(hdr.magic, "GHCNSTAT", 8)!=0 
+     || hdr.version!=STATE_VERSION 
+     || hdr.byteOrder!=0x01020304
+     || hdr.minYear!=MIN_GISS_YEAR
+     || hdr.anomalyNumYears<0)
+  {
+    cerr << path << " isn't a state file from this version of the program" 
+	 << endl;
+    return false;
+  }
+
+  // The sums only hold the stations that passed the -B threshold the
+  // state was made with, and duplicates that were combined can't be
+  // pulled apart again.
+  if(hdr.minBaselineSampleCount!=minBaselineSampleCount)
+  {
+    cerr << path << " was made with -B " << hdr.minBaselineSampleCount 
+	 << ";  use the same value to update it" << endl;
+    return false;
+  }
+  if(hdr.firstBaselineYear!=mFirstBaselineYear 
+     || hdr.lastBaselineYear!=mLastBaselineYear)
+  {
+    cerr << path << " was made with the baseline period " 
+	 << hdr.firstBaselineYear << "-" << hdr.lastBaselineYear 
+	 << ";  use the same period to update it" << endl;
+    return false;
+  }
+  if(hdr.duplicateMode!=DUPLICATES_SEPARATE)
+  {
+    cerr << path << " was made with --duplicates combine, "
+	 << "which can't be updated incrementally" << endl;
+    return false;
+  }
+
+  const char *pp=state.Data()+sizeof(hdr);
+  size_t left=state.Size()-sizeof(hdr);
+  if(hdr.storeBytes>left || !mTemps.Read(pp, (size_t)hdr.storeBytes))
+  {
+    cerr << "Bad station data in state file " << path << endl;
+    return false;
+  }
+  pp+=hdr.storeBytes;
+  left-=hdr.storeBytes;
+
+  size_t ns=mTemps.NumStations();
+  size_t nym=12*(size_t)hdr.anomalyNumYears;
+  size_t countBytes=Align8(12*ns*sizeof(int));
+  size_t baselineBytes=Align8(12*ns*sizeof(float));
+  if(left!=countBytes+baselineBytes+nym*sizeof(double)+Align8(nym*sizeof(int)))
+  {
+    mTemps.Clear();
+    cerr << "State file " << path << " is the wrong size" << endl;
+    return false;
+  }
+
+  const int *counts=(const int*)pp;
+  const float *baselines=(const float*)(pp+countBytes);
+  const double *sums=(const double*)(pp+countBytes+baselineBytes);
+  const int *stationCounts=(const int*)(pp+countBytes+baselineBytes
+                                        +nym*sizeof(double));
+
+  mBaselineSampleCount.assign(counts, counts+12*ns);
+  mBaselineTemperature.assign(baselines, baselines+12*ns);
+  mAnomalyFirstYear=hdr.anomalyFirstYear;
+  mAnomalyNumYears=hdr.anomalyNumYears;
+  mAnomalySum.assign(sums, sums+nym);
+  mAverageStationCount.assign(stationCounts, stationCounts+nym);
+  mStateMinBaselineSampleCount=minBaselineSampleCount;
+  mBaselineWindow=make_pair(mFirstBaselineYear, mLastBaselineYear);
+  mbBaselinesValid=true;
+
+  CountStationsKept(minBaselineSampleCount);
+  AverageAnomalySums();
+  return true;
+}
 
-  // Iterate through all the stations in the temperature map.
-  for(iss=mTempsMap.begin(); iss!=mTempsMap.end(); iss++)
+bool GHCN::ApplyDelta(const int& minBaselineSampleCount)
+{
+  GHCNTempStore delta;
+  if(!mDailyFiles.empty())
+  {
+    ParseDailyFiles(0, mDailyFiles.size(), delta, mCounts);
+  }
+  else if(mbReadInBlocks)
   {
-    // Loop through the years in the temperature baseline period.
-    for(yykey=FIRST_BASELINE_YEAR; yykey<=LAST_BASELINE_YEAR; yykey++)
+    ParseDecompressed([&](const char *begin, const char *end)
     {
-      // Do we have an entry for this particular year?
-      if(iss->second.find(yykey)!=iss->second.end())
-      {
-	for(imm=0; imm<12; imm++)
-	{
-	  // Check for sample validity.  Invalid/missing samples
-	  // have been set equal to GHCN_NOTEMP. Skip over -9999
-	  // missing temperature values.
-	  if(iss->second[yykey][imm] > GHCN_NOTEMP()+ERR_EPS())
-	  {
-	    bool first_count=false;
+      ParseRecords(begin, end, delta, mCounts);
+    });
+  }
+  else
+  {
+    ParseRecords(mInputFile.Data(), mInputFile.Data()+mInputFile.Size(), 
+                 delta, mCounts);
+  }
+  delta.Finalize();
+  mInputFile.Close();
 
-	    // Probably overkill here -- but I don't want to assume that
-	    // all new map entries are initialized to 0.
-	    // Check to see if there's a station entery in the baseline sample count map.
-	    if(mBaselineSampleCount.find(iss->first) 
-	       == mBaselineSampleCount.end())
-	    {
-	      first_count=true;
-	    }
-	    // If there is a station entry, check to see if there's a month
-	    // entry in this map.
-	    else if(mBaselineSampleCount[iss->first].find(imm) 
-	            == mBaselineSampleCount[iss->first].end())
-	    {
-	      first_count=true;
-	    }
+  mDeltaStations=delta.NumStations();
+  mBaselinesRecomputed=0;
 
-	    // No station/month entry in this map yet -- so create one
-	    // and make sure that the baseline sample-count value is initialized to 0.
-	    if(first_count==true)
-	    {
-	      mBaselineSampleCount[iss->first][imm]=0;
-	    }
+  // Baselines kept for other windows would go stale.
+  mBaselineCache.clear();
+  mPrefixStart.clear();
+  mPrefixSum.clear();
+  mPrefixCount.clear();
 
-	    // First valid temperature for this station and month?
-	    // Then initialize the baseline temperature map to the
-	    // temperature value.
-	    if(mBaselineSampleCount[iss->first][imm]<1)
-	    {
-	      mBaselineTemperature[iss->first][imm]=iss->second[yykey][imm];
-	    }
-	    else
-	    {
-	      // Already have a temperature sum going -- update it.
-	      mBaselineTemperature[iss->first][imm]+=iss->second[yykey][imm];
-	    }
-	    // Increment the baseline sample count for this station and month.
-	    mBaselineSampleCount[iss->first][imm]+=1;
-	  }
-	}
+  // Take the stations' current anomalies back out of the sums.
+  for(int id=0; id<delta.NumStations(); id++)
+  {
+    int is=mTemps.FindStation(delta.StationId(id));
+    if(is>=0)
+    {
+      StationAnomalies(mTemps, is, &mBaselineSampleCount[12*(size_t)is],
+                       &mBaselineTemperature[12*(size_t)is],
+                       minBaselineSampleCount, mAnomalyFirstYear,
+                       mAnomalySum.data(), mAverageStationCount.data(), -1);
+    }
+  }
+
+  // Records for years the store already has room for are written in 
+  // place.  Anything else (new stations, years beyond a station's 
+  // range) means rebuilding the store around them.
+  GHCNTempStore grow;
+  for(int id=0; id<delta.NumStations(); id++)
+  {
+    for(int iy=0; iy<delta.NumYears(id); iy++)
+    {
+      if(delta.IsPresent(id,iy)
+         && !mTemps.ReplaceRecord(delta.StationId(id), delta.FirstYear(id)+iy,
+                                  delta.Row(id,iy)))
+      {
+	grow.AddRecord(delta.StationId(id), delta.FirstYear(id)+iy, 
+	               delta.Row(id,iy));
       }
     }
   }
 
-  // Divide each baseline temperature sum by the number of valied samples 
-  // found in the baseline time-period for each station and month to
-  // get the baseline average temperature for the corresponding station and month.
-  for(iss=mTempsMap.begin(); iss!=mTempsMap.end(); iss++)
+  if(grow.NumStations()>0)
   {
-    for(imm=0; imm<12; imm++)
+    grow.Finalize();
+
+    // Station indices shift, so carry the baselines over by key.
+    vector<GHCNStationKey> oldKeys(mTemps.NumStations());
+    for(int is=0; is<mTemps.NumStations(); is++)
+    {
+      oldKeys[is]=mTemps.StationId(is);
+    }
+
+    mTemps.Append(grow);
+    mTemps.Finalize();
+
+    vector<int> counts(12*(size_t)mTemps.NumStations(), 0);
+    vector<float> baselines(12*(size_t)mTemps.NumStations(), 0.0f);
+    size_t jo=0;
+    for(int is=0; is<mTemps.NumStations(); is++)
     {
-      if(mBaselineSampleCount[iss->first][imm]>1)
+      if(jo<oldKeys.size() && oldKeys[jo]==mTemps.StationId(is))
       {
-	mBaselineTemperature[iss->first][imm] /= mBaselineSampleCount[iss->first][imm];
+	copy(&mBaselineSampleCount[12*jo], &mBaselineSampleCount[12*jo]+12,
+	     &counts[12*(size_t)is]);
+	copy(&mBaselineTemperature[12*jo], &mBaselineTemperature[12*jo]+12,
+	     &baselines[12*(size_t)is]);
+	jo++;
       }
     }
+    mBaselineSampleCount.swap(counts);
+    mBaselineTemperature.swap(baselines);
+  }
+
+  // Put the stations' anomalies back in, with new baselines for any
+  // station whose baseline years were touched.
+  for(int id=0; id<delta.NumStations(); id++)
+  {
+    int is=mTemps.FindStation(delta.StationId(id));
+    int firstYear=delta.FirstYear(id);
+    int lastYear=firstYear+delta.NumYears(id)-1;
+
+    if(firstYear<=mLastBaselineYear && lastYear>=mFirstBaselineYear)
+    {
+      StationBaseline(mTemps, is, mFirstBaselineYear, mLastBaselineYear,
+                      &mBaselineSampleCount[12*(size_t)is],
+                      &mBaselineTemperature[12*(size_t)is]);
+      mBaselinesRecomputed++;
+    }
+
+    GrowAnomalyYears(mTemps.FirstYear(is), 
+                     mTemps.FirstYear(is)+mTemps.NumYears(is)-1);
+    StationAnomalies(mTemps, is, &mBaselineSampleCount[12*(size_t)is],
+                     &mBaselineTemperature[12*(size_t)is],
+                     minBaselineSampleCount, mAnomalyFirstYear,
+                     mAnomalySum.data(), mAverageStationCount.data());
   }
+
+  CountStationsKept(minBaselineSampleCount);
+  AverageAnomalySums();
+  return true;
 }
 
 void GHCN::ReadTemps(void)
 {
-  string year;
-  string month;
-  int cc;
-  int ss;
-  int tt[12];
-  int yy;
-  
-  mInputFstream->exceptions(fstream::badbit 
-			    | fstream::failbit 
-			    | fstream::eofbit);
+  if(!mDailyFiles.empty())
+  {
+    // (No snapshots of a directory:  there's no one file to hash.)
+    ReadDailyFiles();
+    ApplyDuplicateMode();
+    ApplyFilter();
+    return;
+  }
+
+  const char *data=mInputFile.Data();
+  size_t size=mInputFile.Size();
+  int nchunks=(int)MIN((size_t)mNumThreads, size/MIN_CHUNK_BYTES);
+  uint64_t sourceHash=0;
+  string cachePath;
 
-  try
+  // (No snapshots of a stream either:  it can't be hashed before it's
+  // been read.)
+  bool useCache=!mCacheDir.empty() && mInputStream==NULL;
+
+  if(useCache)
   {
-    while(!mInputFstream->eof())
+    sourceHash=GHCNHash64(data,size);
+    cachePath=CachePath(sourceHash);
+    mbLoadedFromCache=LoadCache(cachePath, sourceHash, size);
+    if(mbLoadedFromCache)
     {
-	
-      mInputFstream->getline(mCbuf,BUFLEN);
+      mDecompressor.Stop();
+      mInputFile.Close();
+      ApplyDuplicateMode();
+      ApplyFilter();
+      return;
+    }
+  }
+
+  if(mbReadInBlocks)
+  {
+    // One parser, keeping pace with the reading thread.
+    ParseDecompressed([&](const char *begin, const char *end)
+    {
+      ParseRecords(begin, end, mTemps, mCounts);
+    });
+  }
+  else if(nchunks<=1)
+  {
+    ParseRecords(data, data+size, mTemps, mCounts);
+  }
+  else
+  {
+    // Split the file into roughly equal byte ranges, each pushed forward
+    // to start just after a newline, so that every line lands in exactly
+    // one chunk.  Each chunk is parsed into its own store, then the
+    // stores are appended in file order so later records still win.
+    vector<const char*> bounds(nchunks+1);
+    bounds[0]=data;
+    bounds[nchunks]=data+size;
+    for(int ic=1; ic<nchunks; ic++)
+    {
+      const char *pp=data+size*ic/nchunks;
+      pp=MAX(pp,bounds[ic-1]);
+      const char *eol=(const char*)memchr(pp, '\n', data+size-pp);
+      bounds[ic]=StationYearStart((eol!=NULL) ? eol+1 : data+size, 
+                                  data, data+size);
+    }
+
+    vector<GHCNTempStore> partial(nchunks);
+    vector<ParseCounts> partialCounts(nchunks, ParseCounts());
+    GHCNParallelFor(nchunks, mNumThreads, [&](int ic)
+    {
+      ParseRecords(bounds[ic], bounds[ic+1], partial[ic], partialCounts[ic]);
+      partial[ic].Finalize();
+    });
 
-      sscanf(mCcountry, "%3d", &cc);
+    for(int ic=0; ic<nchunks; ic++)
+    {
+      mTemps.Append(partial[ic]);
+      partial[ic].Clear();
+      AddCounts(mCounts, partialCounts[ic]);
+    }
+  }
 
-      sscanf(mCstation, "%5d", &ss);
-      mIstation=ss;
+  mInputFile.Close();
 
-      sscanf(mCyear,"%4d",&yy);
-      mIyear=yy;
+  mTemps.Finalize();
 
-      // Initialize to "invalid" temperature values
-      // so we can keep track of data-gaps.
-      int ii;
-      for(ii=0; ii<12; ii++)
+  if(useCache)
+  {
+    SaveCache(cachePath, sourceHash, size);
+  }
+
+  ApplyDuplicateMode();
+  ApplyFilter();
+  
+}
+
+bool GHCN::CountrySelected(GHCNStationKey station) const
+{
+  if(mCountries.empty())
+  {
+    return true;
+  }
+  return find(mCountries.begin(), mCountries.end(), 
+              GHCNCountryKey(station))!=mCountries.end();
+}
+
+bool GHCN::StationSelected(GHCNStationKey station) const
+{
+  float lat, lon;
+  return CountrySelected(station) 
+    && (mRegion==NULL 
+	|| (mInventory->Find(station, lat, lon) && mRegion->Contains(lat, lon)));
+}
+
+void GHCN::ApplyFilter(void)
+{
+  if(!HasFilter())
+  {
+    return;
+  }
+
+  vector<int> selected;
+  SelectStations(selected);
+
+  mStationsFilteredOut=mTemps.NumStations()-(int)selected.size();
+
+  GHCNTempStore kept;
+  mTemps.Extract(selected, kept);
+  swap(mTemps, kept);
+}
+
+void GHCN::SelectStations(vector<int>& selected) const
+{
+  selected.clear();
+
+  if(mRegion!=NULL)
+  {
+    // Look the region's stations up in the inventory's spatial index, 
+    // then find each one's duplicates (adjacent keys) in the store.
+    vector<GHCNStationKey> groups;
+    mInventory->FindInRegion(*mRegion, groups);
+    for(size_t ig=0; ig<groups.size(); ig++)
+    {
+      if(!CountrySelected(groups[ig]))
       {
-	tt[ii]=GHCN_NOTEMP();
+	continue;
       }
-
-      if(mIyear >= MIN_GISS_YEAR)
+      for(int is=mTemps.LowerBound(groups[ig]); 
+	  is<mTemps.NumStations() 
+	    && GHCNStationGroup(mTemps.StationId(is))==groups[ig]; 
+	  is++)
       {
-	sscanf(mCtemps,"%5d%5d%5d%5d%5d%5d%5d%5d%5d%5d%5d%5d",
-	       &tt[0],&tt[1],&tt[2],&tt[3],&tt[4],&tt[5],
-	       &tt[6],&tt[7],&tt[8],&tt[9],&tt[10],&tt[11]);
-	
-	mTempsMap[mIstation][mIyear].resize(12);
-	
-	for(ii=0; ii<12; ii++)
-	{
-	  if(tt[ii]>GHCN_NOTEMP()+ERR_EPS())
-	  {
-	    // Got a valid value? Divide the GHCN temperature*10
-	    // number down to get the proper temperature value.
-	    mTempsMap[mIstation][mIyear][ii]=tt[ii]/10.0;
-	  }
-	  else
-	  {
-	    // Make sure missing temperature values are marked
-	    // by -9999 entries in the station/year/month temperature map.
-	    mTempsMap[mIstation][mIyear][ii]=GHCN_NOTEMP();
-	  }
-	}
+	selected.push_back(is);
+      }
+    }
+  }
+  else if(!mCountries.empty())
+  {
+    // Keys sort by country first, so each country is one run of 
+    // stations.
+    vector<GHCNStationKey> countries(mCountries);
+    sort(countries.begin(), countries.end());
+    countries.erase(unique(countries.begin(), countries.end()), 
+                    countries.end());
+    for(size_t ic=0; ic<countries.size(); ic++)
+    {
+      int is_end=mTemps.LowerBound(GHCNNextCountryKey(countries[ic]));
+      for(int is=mTemps.LowerBound(countries[ic]); is<is_end; is++)
+      {
+	selected.push_back(is);
       }
     }
   }
-  catch(fstream::failure ff)
+  else
   {
-    cerr << endl 
-	 << "fstream:: Failure error thrown. " << endl
-	 << "(No problemo -- just reached end of file)." 
-	 << endl << endl;
+    for(int is=0; is<mTemps.NumStations(); is++)
+    {
+      selected.push_back(is);
+    }
   }
-
-  mInputFstream->close();
-  
 }
 
-
-void ProcessOptions(int argc, char **argv)
+void GHCN::ApplyDuplicateMode(void)
 {
-  int optRtn;
-
-  if(argc<2)
+  if(mDuplicateMode==DUPLICATES_COMBINE)
   {
-    cerr << endl 
-	 << "Usage: " << argv[0]  << endl
-	 << "         [-A (int)smoothing-filter-length-years] \\ " << endl
-         << "         [-B (int)min-baseline-sample-count] \\ "     << endl
-         << "         (char*)GHCN-file1 (char*)GHCN-file2... " << endl
-	 << endl;
-    exit(1);
+    GHCNTempStore combined;
+    CombineDuplicates(mTemps, combined);
+    swap(mTemps, combined);
   }
-  
-  minBaselineSampleCount_g=GHCN::DEFAULT_MIN_BASELINE_SAMPLE_COUNT;
-  avgNyear_g=GHCN::DEFAULT_AVG_NYEAR;
-  
-  while ((optRtn=getopt(argc,argv,"A:B:"))!=-1)
+}
+
+void GHCN::CombineDuplicates(const GHCNTempStore& in, GHCNTempStore& out)
+{
+  int nstations=in.NumStations();
+  double sum[12];
+  int count[12];
+  float temps[12];
+
+  out.Reset();
+
+  int is=0;
+  while(is<nstations)
   {
-    switch(optRtn)
+    // Duplicates of a station have adjacent keys, so they're adjacent
+    // in the store.
+    GHCNStationKey group=GHCNStationGroup(in.StationId(is));
+    int is_end=is+1;
+    int firstYear=in.FirstYear(is);
+    int lastYear=in.FirstYear(is)+in.NumYears(is)-1;
+    while(is_end<nstations && GHCNStationGroup(in.StationId(is_end))==group)
     {
-      case 'A':
-	avgNyear_g=atoi(optarg);
-	break;
-	
-      case 'B':
-	minBaselineSampleCount_g=atoi(optarg);
-	break;
-	
-      default:
-	cerr << endl;
-	cerr << "Usage: " << argv[0] << endl
-	     << "         [-A (int)smoothing-filter-length-years] \\ " << endl
-	     << "         [-B (int)min-baseline-sample-count] \\ "  << endl
-	     << "         (char*)GHCN-file1 (char*)GHCN-file2... " << endl
-	     << endl;
-	exit(1);
-    }
-  }
-  avgNyear_g=MAX(1,MIN(GHCN::MAX_AVG_NYEAR,avgNyear_g));
-  minBaselineSampleCount_g=MAX(1,
-     MIN(GHCN::LAST_BASELINE_YEAR-GHCN::FIRST_BASELINE_YEAR+1,
-	 minBaselineSampleCount_g));
-  
+      firstYear=MIN(firstYear, in.FirstYear(is_end));
+      lastYear=MAX(lastYear, in.FirstYear(is_end)+in.NumYears(is_end)-1);
+      is_end++;
+    }
+
+    for(int yy=firstYear; yy<=lastYear; yy++)
+    {
+      bool present=false;
+      for(int imm=0; imm<12; imm++)
+      {
+	sum[imm]=0.0;
+	count[imm]=0;
+      }
+
+      for(int js=is; js<is_end; js++)
+      {
+	const float *row=in.Temps(js,yy);
+	if(row==NULL || !in.IsPresent(js, yy-in.FirstYear(js)))
+	{
+	  continue;
+	}
+	present=true;
+	unsigned mask=in.RowMask(js, yy-in.FirstYear(js));
+	for(int imm=0; imm<12; imm++)
+	{
+	  unsigned valid=(mask>>imm)&1;
+	  sum[imm]+=valid ? row[imm] : 0.0f;
+	  count[imm]+=valid;
+	}
+      }
+
+      if(present)
+      {
+	for(int imm=0; imm<12; imm++)
+	{
+	  temps[imm] = count[imm]>0 ? (float)(sum[imm]/count[imm]) 
+	                            : GHCN_NOTEMP();
+	}
+	out.AddRecord(group, yy, temps);
+      }
+    }
+
+    is=is_end;
+  }
+
+  out.Finalize();
 }
 
+
 void DumpSmoothedResults(GHCN **ghcn, int ngh)
 {
   
   map<int, double >::iterator iyy;
   int igh;
+  GHCNCsvWriter csv(cout);
   
   // Iterate over years
   for(iyy=ghcn[0]->mSmoothedGlobalAverageAnnualAnomalies.begin();
@@ -570,111 +2484,33 @@ void DumpSmoothedResults(GHCN **ghcn, int ngh)
   {
     // Results for first input file
     // First 
-    cout << iyy->first << ","
-	 << iyy->second << ",";
+    csv.Put(iyy->first);
+    csv.Put(',');
+    csv.Put(iyy->second);
+    csv.Put(',');
 
     // Results for additional input files
     for(igh=1; igh<ngh; igh++)
     {
-      if(ghcn[igh]->mSmoothedGlobalAverageAnnualAnomalies.find(iyy->first) != 
-	 ghcn[igh]->mSmoothedGlobalAverageAnnualAnomalies.end())
+      map<int, double>::const_iterator it=
+	ghcn[igh]->mSmoothedGlobalAverageAnnualAnomalies.find(iyy->first);
+      if(it!=ghcn[igh]->mSmoothedGlobalAverageAnnualAnomalies.end())
       {
-	cout << ghcn[igh]->mSmoothedGlobalAverageAnnualAnomalies[iyy->first];
-	// Don't need a trailing comma after the last field
-	if(igh<ngh-1)
-	     cout << ",";
+	csv.Put(it->second);
       }
-      else
+      // else no valid data for this year -- leave a blank/null csv
+      // placeholder.
+      
+      // Don't need a trailing comma after the last field
+      if(igh<ngh-1)
       {
-	// No valid data for this year -- put in a blank/null csv placeholder
-	// Also, don't need a trailing comma after the last field
-	if(igh<ngh-1)
-	  cout << ",";
+	csv.Put(',');
       }
-
     }
-    cout << endl; // end of this csv line..
+    csv.EndLine(); // end of this csv line..
 
   }
 
   return;
   
 }
-
-
-
-int main(int argc, char **argv)
-{
-
-  // GHCN* ghcn[MAXFILES];
-  int igh;
-  
-//  int ProcessOptions(int argc, char **argv);
-  
-  void DumpSmoothedResults(GHCN **ghcn, int nghcn);
-
-  ProcessOptions(argc,argv);
-  
-  // if(argc-optind>MAXFILES)
-  // {
-  //   cerr << "Too many input file args" << endl;
-  //   exit(1);
-  // }
-  
-  
-  cerr << endl 
-       << "Smoothing filter length = " << avgNyear_g 
-       << endl << endl;
-  
-  cerr << endl
-       << "Will crunch " << argc-optind << " temperature files. " 
-       << endl << endl;
-  
-  GHCN** ghcn = new GHCN*[argc-optind];
-  
-
-  // Loop through the GHCN file command-line args.
-  for(igh=0; igh<argc-optind; igh++)
-  {
-    ghcn[igh] = new GHCN(argv[igh+optind],avgNyear_g);
-  
-    cerr << "Reading data from " 
-	      << argv[igh+optind] << endl;
-    ghcn[igh]->ReadTemps();
-    
-    cerr << "Computing baseline temps for " 
-	 << argv[igh+optind]<< endl;
-    ghcn[igh]->ComputeBaselines();
-    
-    cerr << "Computing average anomalies for " 
-	 << argv[igh+optind] << endl;
-    ghcn[igh]->ComputeGlobalAverageAnomalies(minBaselineSampleCount_g);
-    
-    ghcn[igh]->MergeMonthsToYear(GHCN::MERGE_AVG);
-    
-    cerr << "Computing " << avgNyear_g <<"-year moving averages for " 
-	 << argv[igh+optind] << endl;
-    ghcn[igh]->ComputeMovingAvg(avgNyear_g);
-
-    cerr << endl << endl;
-  
-  }
-  
-  cerr << "Dumping results... " << endl<<endl<<endl;
-  
-  DumpSmoothedResults(ghcn, argc-optind);
-
-  //
-  // Get segfaults with explicit delete operations.
-  // dunno why.... valgrind gives this app a clean
-  // bill of health regarding illegal memory accesses.
-  // for(igh=0; igh<argc-optind; argc++)
-  // {
-  //   delete ghcn[igh];
-  // }
-  // delete[] ghcn;
-  
-  
-  return 0;
-  
-}
@@ -1,54 +1,199 @@
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <string>
+#include <algorithm>
+#include <bitset>
 
 #if defined(_WIN32)
 #include "getopt.h"
 #else
 #include <unistd.h>
+#include <getopt.h>
 #endif
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "GHCNio.hpp"
+#include "GHCNformat.hpp"
+#include "GHCNdecompress.hpp"
+#include "GHCNinventory.hpp"
+#include "GHCNgrid.hpp"
+#include "GHCNarena.hpp"
 
 /*
 
   How to compile:
 
-    g++ GHCNcsv.cpp -o gcsv.exe
+    g++ -O2 -pthread GHCNmain.cpp GHCNcsv.cpp GHCNio.cpp GHCNtimer.cpp \
+        GHCNbench.cpp GHCNstats.cpp GHCNinventory.cpp GHCNgrid.cpp \
+        GHCNquery.cpp GHCNarena.cpp GHCNserver.cpp GHCNoutput.cpp \
+        GHCNformat.cpp GHCNdecompress.cpp -o gcsv.exe
+
+    (GHCNmain.cpp is just the gcsv program;  leave it out to use the
+    analysis from other code -- see GHCNquery.hpp.)
 
 
 
   How to run:
 
-    Download and uncompress the GHCN v2 temperature files 
+    Download the GHCN v2 temperature files 
               (v2.mean.Z, v2.mean_adj.Z, etc.)
 
     The compressed data files are available at: 
                      ftp://ftp.ncdc.noaa.gov/pub/data/ghcn/v2/
         
 
-    To uncompress the GHCN files:
-      uncompress v2.whatever.Z
+    There's no need to uncompress them:  .Z (compress) and .gz (gzip)
+    files are recognised by their contents and decompressed in a 
+    separate thread while the lines already decompressed are parsed.
+    (A compressed file is parsed by one thread, whatever -j says;  the
+    --cache-dir snapshot, if any, is keyed on the compressed file.)
 
 
     To run this utility:
 
-      ./gcsv.exe  v2.mean v2.mean_adj v2.max...  > data.csv
+      ./gcsv.exe  v2.mean.Z v2.mean_adj.Z v2.max.Z...  > data.csv
 
 
       Anomaly outputs will be stored in data.csv in spreadsheet-readable form.
 
+    An input named - is read from standard input, and pipes and FIFOs
+    work too, so data can come straight out of another program.  These
+    are read a few MB at a time by a separate thread, while the block
+    before is parsed (and decompressed first, if the data is .Z or .gz):
+
+      tar -xzOf ghcnm.tavg.latest.qcf.tar.gz --wildcards '*.dat' \
+        | ./gcsv.exe -  > data.csv
+
+    GHCN-M v3 and v4 files (ghcnm.tavg.*.dat etc.) are read as they
+    come;  the format of each file is worked out from its first line.
+    Values with a QC flag set are left out, unless --qc-flagged keep
+    is given.
+
+      ./gcsv.exe  ghcnm.tavg.v4.0.1.20240101.qcf.dat  > data.csv
+
+    GHCN-Daily data is averaged into monthly temperatures as it's
+    read.  An input can be one .dly file (or several catted together),
+    or a directory, whose *.dly files are read as one data set, several
+    files at a time in parallel.  --daily-element picks TAVG (the
+    default), TMAX or TMIN, and a month needs --min-days valid days
+    (after QC) to get a mean:
+
+      ./gcsv.exe -j 8 --daily-element TMAX --min-days 25 ghcnd_all > tmax.csv
+
+    With -S, the daily files are parsed a batch at a time and only one
+    station's monthly values are held at once.
+
+    The input files are independent of each other, so they can be 
+    crunched concurrently:
+
+      ./gcsv.exe -j 4 v2.mean v2.mean_adj v2.max...  > data.csv
+
+    -j 0 uses all cores.  Output columns are always in command-line order.
+
+    Parsing the text files is the slow part of a run.  With -c, a
+    binary snapshot of each parsed file is kept in the given directory
+    and reused for as long as the file's contents don't change:
+
+      ./gcsv.exe -c ~/.gcsv-cache -A 9 v2.mean v2.mean_adj  > data.csv
+
+    For archives too big to hold in memory, -S streams each file in a
+    single pass, only keeping one station's data at a time.  The input
+    has to be sorted by station, as the GHCN files are.
+
+    By default every station counts the same in the global average,
+    so regions with lots of stations dominate it.  With --grid and the
+    station inventory (v2.temperature.inv, or a v3 or v4 .inv file), the
+    stations are binned into grid cells, averaged within each cell, and
+    the cells averaged by area:  cos(latitude) weights for a lat/lon 
+    grid.  An equal-area grid's cells come close to equal, but each is
+    weighted by its exact area, since the cell count in a band is
+    rounded.
+
+      ./gcsv.exe --inventory v2.temperature.inv --grid latlon \
+                 --cell-size 5 v2.mean  > data.csv
+
+    --country (GHCN country numbers for v2/v3 data, 2-letter FIPS 
+    codes for v4 and daily data, comma-separated) and 
+    --region lat0,lat1,lon0,lon1
+    (a lat/lon box, which needs the inventory) restrict a run to the
+    stations picked out:
+
+      ./gcsv.exe --inventory v2.temperature.inv --region 35,70,-10,40 \
+                 v2.mean  > europe.csv
+
+    Stations are keyed by their full 12-digit ID (country code, WMO
+    number, modifier, duplicate digit).  --duplicates combine averages
+    each station's duplicate series month by month into one station;
+    the default, --duplicates separate, keeps them apart.  (v3 and v4
+    IDs have no duplicate digit.)
+
+    For regular updates to a big archive, --save-state keeps the parsed
+    stations, baselines and anomaly sums of a run, and --load-state 
+    picks them up again, treating the input file as a delta:  new or
+    replacement station-year records.  Only the stations in the delta
+    are redone (their baselines too, if the delta has baseline years):
+
+      ./gcsv.exe --save-state v2.state v2.mean  > data.csv
+      ./gcsv.exe --load-state v2.state --save-state v2.state \
+                 v2.update > data.csv
+
+    --baseline Y0-Y1 measures the anomalies against the years Y0 to Y1
+    instead of 1951-1980:
+
+      ./gcsv.exe --baseline 1961-1990 v2.mean  > data.csv
+
+    --arrow PREFIX also writes the results as typed columns in Arrow
+    IPC files (Feather v2), which pandas, polars, R etc. load without
+    any parsing:  PREFIX.monthly.arrow (year, month, then each input
+    file's monthly anomalies and station counts), PREFIX.annual.arrow
+    and PREFIX.smoothed.arrow (year, then a column per input file).
+    Missing values are nulls.
+
+    --queries FILE runs many analyses of one input file without
+    re-reading it:  one query per line of FILE, each with its own -A,
+    -B, merge mode, baseline period, countries and region (see 
+    GHCNquery.hpp).  Each query's smoothed anomalies come out as one
+    column of the CSV, headed by the query's name:
+
+      ./gcsv.exe --inventory v2.temperature.inv --queries runs.txt \
+                 v2.mean  > runs.csv
+
+    --serve SOCKET reads the input files and keeps them in memory,
+    answering queries from local clients on a Unix-domain socket (see
+    GHCNserver.hpp for the protocol) until one asks it to shut down:
+
+      ./gcsv.exe --serve /tmp/gcsv.sock v2.mean v2.mean_adj &
+      echo "file=v2.mean baseline=1961-1990 A=5" | nc -U /tmp/gcsv.sock
+
+    --stats FILE writes per-file, per-stage timings (wall, CPU, peak
+    RSS) and counters (lines, records kept and dropped, stations kept
+    and dropped by -B, array sizes) to FILE as JSON;  "-" means stderr.
+    CPU times are for the whole process, so they're only per-file
+    figures when the files are crunched one at a time.
+
+    To see how fast each stage runs on this machine, --bench writes a
+    synthetic v2 file of the given size and times crunching it:
+
+      ./gcsv.exe --bench -s 20000 -y 130 -m 0.1 -j 4
+
 
   Some parameters to twiddle with...:
 
   MIN_GISS_YEAR defines the first year of data to extract.
                 The standard value is 1880 (NASA/GISS convention)
 
-  FIRST_BASELINE_YEAR defines the first year of the baseline period.
-  LAST_BASELINE_YEAR defines the last year of the baseline period.
+  FIRST_BASELINE_YEAR defines the default first year of the baseline period.
+  LAST_BASELINE_YEAR defines the default last year of the baseline period.
                      The NASA/GISS standard baseline period is 1951-1980
+                     (--baseline Y0-Y1 picks another at run time)
 
   DEFAULT_MIN_BASELINE_SAMPLE_COUNT defines the default minimum number 
                                    of valid temperature samples in the baseline 
@@ -64,31 +209,39 @@
                    filter.  This is set to 5 years (below).  Can be overridden
                    with the command-line arg -A .
 
+  DEFAULT_MIN_DAYS_PER_MONTH defines the default number of valid days a 
+                   month of GHCN-Daily data needs to get a monthly mean.
+                   Can be overridden with --min-days .
+
 
 
 Overall approach.
 
 
-1) The program reads in temperature data from a GHCN version-2 
-   temperature data file and places the temperature samples in
-   the mTempsMap class member.
+1) The program reads in temperature data from a GHCN version-2
+   (or v3/v4) temperature data file and places the temperature samples in
+   the mTemps class member.
 
-   mTempsMap is a nested STL map template indexed by station
-   ID number and year.  Each station-id/year element is a
-   12 element vector containing the temperature for each month
-   for the given station and year.
+   mTemps is a dense GHCNTempStore: a table of stations (sorted by
+   station ID), each owning a contiguous range of years, and one flat
+   float array holding 12 contiguous monthly temperatures per
+   station-year.
 
-   temperatures are indexed by: mTempsMap[station-id][year][month]
+   temperatures are accessed by: mTemps.Temps(station-index,year)[month]
 
-   The STL map template and iterator function make easy to deal
-   with data gaps (not all stations have temperature date for
-   all years/months).
+   Data gaps (not all stations have temperature data for all 
+   years/months) are stored as GHCN_NOTEMP, so every pass over the
+   data is a linear scan of the flat array.  Each station-year also
+   carries a 12-bit mask of its valid months, worked out once when the
+   row is stored, so the baseline and anomaly loops select values by
+   mask bits instead of comparing every value against GHCN_NOTEMP.
 
 
-2) The 1950-1981 baseline temperatures are computed for each 
+2) The baseline temperatures (over FIRST_BASELINE_YEAR to
+   LAST_BASELINE_YEAR, or the --baseline period) are computed for each
    station/month and placed in the class member mBaselineTemperature
 
-   mBaselineTemperature is a nested STL map indexed by station-id and month.
+   mBaselineTemperature is a flat array indexed by station-index and month.
 
    Since there are gaps in the data, there will be variations in the
    number of valid temperature samples in the baseline period for the
@@ -97,7 +250,10 @@ Overall approach.
    The class member mBaselineSampleCount keeps track of the number
    of valid samples for each station/month in the baseline period.
 
-   mBaselineSampleCount is a nested map indexed by station-id and month.
+   mBaselineSampleCount is a flat array indexed by station-index and month.
+
+   Each station's baselines only depend on its own data, so the
+   stations are split into blocks that are worked on in parallel.
 
    For a temperature station to be included in the final average anomaly
    calculations for any given month, the station must have at least
@@ -108,24 +264,29 @@ Overall approach.
 3) After all the baseline temperatures are calculated for each
    station/month, temperature anomalies for each station/year/month
    are calculated by subtracting the mBaselineTemperature[station][month]
-   element from the mTempMap elements corresponding to the same station/month;
+   element from the mTemps elements corresponding to the same station/month;
    and averaged over all stations to produce global average anomalies
    for each year/month (stored in mGlobalAverageMonthlyAnomalies).
 
+   Each block of stations sums its anomalies into its own dense
+   year x month array;  the blocks are then added together pairwise
+   in a fixed tree order.  The block size is fixed, so the result
+   is bit-for-bit the same whatever the number of threads.
+
 
 4) The monthly global-average anomalies are then merged into 
    annual global-average anomalies by merging each set of 12 months
    into a single annual global average anomaly.  
 
-   Merging choices are average, minimum, or maximum (must change the
-   argument GHCN::MERGE_MODE argument passed into the 
-   GHCN::MergeMonthsToYear() method call and recompile).  Current 
-   merging is GHCN::MERGE_AVG (averaging).
+   Merging choices are average, minimum, or maximum (the
+   GHCN::MERGE_MODE passed to GHCN::MergeMonthsToYear()).  A run
+   averages (GHCN::MERGE_AVG);  a query picks another with merge=max
+   or merge=min (see --queries above).
 
 
 5) Annual anomalies are then smoothed with a moving-average filter.
-   Moving-average filter length can be changed by changing AVG_NYEAR
-   and recompiling.
+   The moving-average filter length is DEFAULT_AVG_NYEAR, or the -A
+   value (or a query's A=).
 
 6) Final results are written out to standard output in CSV format.
    Redirect to a file with the unix redirect (>) operator.
@@ -139,7 +300,157 @@ using namespace std;
 #define MIN(a,b) ((a)<(b)?(a):(b))
 #define MAX(a,b) ((a)>(b)?(a):(b))
 
-#define BUFLEN (512)  // more than long enough for input lines
+
+
+// Dense station x year x month temperature store.
+//
+// Stations are kept in ascending station-ID order.  Each station owns
+// a contiguous range of years, and each station-year is a row of 12
+// contiguous monthly temperatures in a single flat float array:
+//
+//   mTemps[mOffset[is] + 12*(year-mFirstYear[is]) + month]
+//
+// Years inside a station's range with no data line in the input
+// are filled with NOTEMP, exactly like missing months, and are
+// flagged as not present (see IsPresent()).
+//
+// Each row has a mask alongside it:  bit imm is set when month imm 
+// holds a valid temperature, and PRESENT_BIT when the row came from an
+// input record.
+class GHCNTempStore
+{
+ public:
+
+  // Same value as GHCN::GHCN_NOTEMP()
+  static float NOTEMP() { return -9999.0f; }
+
+  static const unsigned MONTHS_MASK=0xfff;
+  static const unsigned PRESENT_BIT=0x1000;
+
+  // The month bits for 12 monthly temperatures:  set for the ones 
+  // that aren't NOTEMP.
+  static unsigned ValidMonths(const float *temps);
+
+  // Number of months set in a mask.  (bitset's count() is a popcount
+  // instruction where the compiler has one, and portable otherwise.)
+  static int CountMonths(unsigned mask)
+    { return (int)bitset<12>(mask).count(); }
+
+  GHCNTempStore();
+
+  // Add one station-year (12 monthly temperatures).  Input sorted by
+  // station, as the GHCN files are, is appended in place; out-of-order
+  // records are held back and merged in by Finalize().  A later record
+  // for the same station-year replaces an earlier one.
+  void  AddRecord(GHCNStationKey station, int year, const float *temps);
+
+  // Add every station-year present in another (finalized) store, as
+  // if its records were added one by one after the ones already here.
+  void  Append(const GHCNTempStore& other);
+
+  // Overwrite the row for a year inside an existing station's range
+  // (either a present year or a gap).  Returns false, and changes 
+  // nothing, if the store has no such station or year.  Only for a 
+  // finalized store;  the station index stays valid.
+  bool  ReplaceRecord(GHCNStationKey station, int year, const float *temps);
+
+  // Merge any held-back records and index the stations.  Call after the
+  // last AddRecord() and before using the accessors below.
+  void  Finalize(void);
+
+  void  Clear(void);
+
+  // Copy the given stations (indices in increasing order) into out, 
+  // which is finalized.
+  void  Extract(const vector<int>& stations, GHCNTempStore& out) const;
+
+  // Empty the store but hang onto its memory, for reuse.
+  void  Reset(void);
+
+  int   NumStations(void) const { return (int)mStationId.size(); }
+  GHCNStationKey StationId(int is) const { return mStationId[is]; }
+
+  // Index of the first station whose key is >= station (NumStations()
+  // if there's none).
+  int   LowerBound(GHCNStationKey station) const
+    { return (int)(lower_bound(mStationId.begin(), mStationId.end(), station)
+		   -mStationId.begin()); }
+
+  // Index of the station with the given key, or -1 if there isn't one.
+  int   FindStation(GHCNStationKey station) const
+  {
+    unordered_map<GHCNStationKey,int>::const_iterator it=mIndex.find(station);
+    return it!=mIndex.end() ? it->second : -1;
+  }
+  int   FirstYear(int is) const { return mFirstYear[is]; }
+  int   NumYears(int is) const { return mNumYears[is]; }
+
+  // 12 monthly temperatures for the iy'th year (0-based) of station is.
+  const float* Row(int is, int iy) const 
+    { return &mTemps[mOffset[is]+12*(size_t)iy]; }
+
+  // 12 monthly temperatures for station is and the given year, or
+  // NULL if the year is outside the station's range.
+  const float* Temps(int is, int year) const
+  {
+    int iy=year-mFirstYear[is];
+    return (iy>=0 && iy<mNumYears[is]) ? Row(is,iy) : NULL;
+  }
+
+  // Mask of the iy'th year of station is, and of all its years.
+  unsigned RowMask(int is, int iy) const { return mMask[mOffset[is]/12+iy]; }
+  const uint16_t* Masks(int is) const { return &mMask[mOffset[is]/12]; }
+
+  // Did the iy'th year of station is come from an input record (as 
+  // opposed to being a gap in the station's year range)?
+  bool  IsPresent(int is, int iy) const 
+    { return (RowMask(is,iy)&PRESENT_BIT)!=0; }
+
+  // Total number of station-year rows.
+  size_t NumRows(void) const { return mTemps.size()/12; }
+
+  // Bytes held by the store's arrays.
+  size_t MemoryBytes(void) const;
+
+  // Binary image of a finalized store, for the parsed-data cache:  the
+  // station and row counts followed by the raw arrays, each starting
+  // on an 8-byte boundary so the image can be used straight out of a
+  // memory mapping.  Read() replaces the store's contents and returns
+  // false if the image is inconsistent.
+  bool  Write(FILE *fp) const;
+  bool  Read(const char *image, size_t size);
+
+ protected:
+
+  vector<GHCNStationKey> mStationId;
+  vector<int>    mFirstYear;
+  vector<int>    mNumYears;
+  vector<size_t> mOffset;
+  vector<float>  mTemps;
+  vector<uint16_t> mMask;  // one per station-year row
+
+  // Station key -> station index, rebuilt by Finalize() and Read().
+  unordered_map<GHCNStationKey,int> mIndex;
+  void  BuildIndex(void);
+
+  // Add rows for the years [year,year+nyears) in front of (before==true) 
+  // or after the last station's current range.
+  void  GrowLastStation(int year, int nyears, bool before);
+
+  // Records that arrived out of station order.
+  struct PendingRecord
+  {
+    GHCNStationKey station;
+    int year;
+    float temps[12];
+  };
+  vector<PendingRecord> mPending;
+
+  static bool PendingStationLess(const PendingRecord& a, 
+                                 const PendingRecord& b)
+    { return a.station<b.station; }
+  
+};
 
 
 
@@ -149,7 +460,7 @@ class GHCN
 
   // All missing temperature fields in the GHCN files are designated
   // by -9999
-	 static float GHCN_NOTEMP() { return -9999.0f; }
+	 static float GHCN_NOTEMP() { return GHCNTempStore::NOTEMP(); }
 
   // When comparing floating pt. vals against GHCN_NOTEMP,
   // make sure that we don't get bitten by floating-pt precision limitations.
@@ -177,20 +488,127 @@ class GHCN
   static const int MAX_AVG_NYEAR=20;
   // Max length of moving-average filter
 
+  // GHCN-Daily input:  the fewest valid days a month needs to get a
+  // monthly mean.
+  static const int DEFAULT_MIN_DAYS_PER_MONTH=20;
+
+  // Which GHCN-Daily element is averaged into monthly temperatures.
+  enum DAILY_ELEMENT { DAILY_TAVG, DAILY_TMAX, DAILY_TMIN };
+  static const char* DailyElementName(DAILY_ELEMENT element);
+
   // Method of merging/averaging monthly anomalies
   // into a single number for a particular year.
   enum MERGE_MODE { MERGE_AVG, MERGE_MAX, MERGE_MIN };
 
+  // What to do with a station's duplicate series (same country code,
+  // WMO number and modifier, different duplicate digit):  keep them as
+  // separate stations, or average them month by month into one.
+  enum DUPLICATE_MODE { DUPLICATES_SEPARATE, DUPLICATES_COMBINE };
+
   // This will contain the moving-average smoothed global temperature
   // anomalies (1 per year). Map is indexed by year.
   map<int, double> mSmoothedGlobalAverageAnnualAnomalies;
 
+  // Line and record counts from ReadTemps()/StreamTemps().
+  struct ParseCounts
+  {
+    int64_t lines;         // all input lines, blank ones included
+    int64_t records;       // station-years kept (year >= MIN_GISS_YEAR)
+    int64_t rejectedYear;  // station-years dropped (year < MIN_GISS_YEAR)
+    int64_t malformed;     // lines without a readable station ID and year
+    int64_t qcFlagged;     // values dropped for a QC flag (v3/v4)
+  };
+
   GHCN(const char *inFile, const int& avgNyear);
 
   virtual ~GHCN();
 
   bool  IsFileOpen(void);
   void  ReadTemps(void);
+
+  // Single-pass alternative to ReadTemps() + ComputeBaselines() + 
+  // ComputeGlobalAverageAnomalies() for station-sorted input: each
+  // station's records are only held until the next station starts.
+  void  StreamTemps(const int& minBaselineSampleCount);
+  // Number of threads a single file's ingest and analysis may use.
+  void  SetNumThreads(int nthreads) { mNumThreads=MAX(1,nthreads); }
+
+  // Keep binary snapshots of parsed input files in this directory
+  // (empty = don't).  ReadTemps() loads the snapshot instead of parsing
+  // when one exists for the file's exact contents.
+  void  SetCacheDir(const string& dir) { mCacheDir=dir; }
+
+  // Drop the v3/v4 values that have a QC flag set (the default), or 
+  // keep them.
+  void  SetDropQcFlagged(bool drop) { mbDropQcFlagged=drop; }
+
+  // Format of the input file, from its first line.
+  GHCN_FORMAT Format(void) const { return mFormat; }
+  GHCN_COMPRESSION Compression(void) const { return mCompression; }
+
+  // GHCN-Daily input:  the element to use, and the fewest valid days
+  // (after QC) a month needs to get a mean.
+  void  SetDailyOptions(DAILY_ELEMENT element, int minDaysPerMonth)
+    { mDailyElement=element; mMinDaysPerMonth=minDaysPerMonth; }
+
+  // Number of .dly files, when the input is a directory of them.
+  size_t NumDailyFiles(void) const { return mDailyFiles.size(); }
+  bool  LoadedFromCache(void) const { return mbLoadedFromCache; }
+
+  void  SetDuplicateMode(DUPLICATE_MODE mode) { mDuplicateMode=mode; }
+
+  // Area-weighted averaging:  with a grid set, 
+  // ComputeGlobalAverageAnomalies() averages the stations' anomalies 
+  // within each grid cell (stations placed by the inventory;  stations
+  // not in it are left out), then averages the cells using the grid's 
+  // cell weights.  Both must outlive this object.  NULL = plain 
+  // average over all the stations.
+  void  SetGrid(const GHCNInventory *inventory, const GHCNGrid *grid)
+    { mInventory=inventory; mGrid=grid; }
+
+  // Only use the stations in these countries (empty = any) and, if
+  // region isn't NULL, inside region according to the inventory given
+  // to SetGrid().  The stations are picked out right after they're read,
+  // so the later stages only see those.  region must outlive this object.
+  void  SetFilter(const vector<GHCNStationKey>& countries, 
+                  const GHCNRegion *region)
+    { mCountries=countries; mRegion=region; }
+
+  // Indices (in increasing order) of the stations the filter above 
+  // picks out of what's been read.
+  void  SelectStations(vector<int>& selected) const;
+
+  // Restrict ComputeGlobalAverageAnomalies() to some of the stations 
+  // (indices in increasing order), without touching the store.  Used 
+  // to run several differently-filtered queries over one dataset.
+  void  SetStationSubset(const vector<int>& stations);
+  void  ClearStationSubset(void);
+
+  // Baseline period (inclusive years) used by ComputeBaselines(), 
+  // StreamTemps() and the state files;  FIRST_BASELINE_YEAR to 
+  // LAST_BASELINE_YEAR unless set otherwise.  ComputeBaselines() keeps
+  // the baselines of every window it has been asked for, so switching
+  // back to an earlier window costs nothing.  The first window is found
+  // by scanning its years;  once a second one is asked for, running
+  // totals over every station's years are built, and any window after
+  // that is two lookups per station and month.
+  void  SetBaselineWindow(int firstYear, int lastYear)
+    { mFirstBaselineYear=firstYear; mLastBaselineYear=lastYear; }
+  int   FirstBaselineYear(void) const { return mFirstBaselineYear; }
+  int   LastBaselineYear(void) const { return mLastBaselineYear; }
+
+  // Incremental updates.  SaveState() writes everything needed to pick
+  // a finished ComputeGlobalAverageAnomalies() run back up:  the station
+  // store, the baselines and the raw anomaly sums and counts.  
+  // LoadState() reads it back (in place of ReadTemps() + 
+  // ComputeBaselines() + ComputeGlobalAverageAnomalies()) and ApplyDelta()
+  // then parses the input file as a set of new or replacement 
+  // station-year records and adjusts the sums for just the stations it
+  // touches.  Both return false, with a message on cerr, on failure.
+  bool  SaveState(const string& path) const;
+  bool  LoadState(const string& path, const int& minBaselineSampleCount);
+  bool  ApplyDelta(const int& minBaselineSampleCount);
+
   void  ComputeBaselines(void);
   void  ComputeGlobalAverageAnomalies(const int& minBaselineSampleCount);
   void  MergeMonthsToYear(MERGE_MODE mode);
@@ -198,64 +616,367 @@ class GHCN
   void  ComputeMovingAvg(const int& nel);
   void  DumpResults(void);
   void  DumpSmoothedResults(); // MERGE_MODE mode);
+
+  // Results, for writing out.  The monthly arrays are indexed by
+  // [12*(year-AnomalyFirstYear()) + month], for AnomalyNumYears() 
+  // years;  missing monthly anomalies are GHCN_NOTEMP().
+  int   AnomalyFirstYear(void) const { return mAnomalyFirstYear; }
+  const vector<double>& MonthlyAnomalies(void) const 
+    { return mGlobalAverageMonthlyAnomalies; }
+  const vector<int>& MonthlyStationCounts(void) const 
+    { return mAverageStationCount; }
+  const map<int,double>& AnnualAnomalies(void) const 
+    { return mGlobalAverageAnnualAnomalies; }
+
+  // Figures for --stats.
+  const ParseCounts& Counts(void) const { return mCounts; }
+  const GHCNTempStore& TempStore(void) const { return mTemps; }
+  int   StationsKept(void) const { return mStationsKept; }
+  int   StationsDropped(void) const { return mStationsDropped; }
+  size_t BaselineBytes(void) const 
+    { return mBaselineSampleCount.size()*sizeof(int)
+	+ mBaselineTemperature.size()*sizeof(float)
+	+ mPrefixSum.size()*sizeof(double) + mPrefixCount.size()*sizeof(int); }
+  int   AnomalyNumYears(void) const { return mAnomalyNumYears; }
+  size_t NumAnnualAnomalies(void) const 
+    { return mGlobalAverageAnnualAnomalies.size(); }
+  int   StationsFilteredOut(void) const { return mStationsFilteredOut; }
+  int   StationsUnlocated(void) const { return mStationsUnlocated; }
+  int   GridCellsUsed(void) const { return mGridCellsUsed; }
+  int   DeltaStations(void) const { return mDeltaStations; }
+  int   BaselinesRecomputed(void) const { return mBaselinesRecomputed; }
+  size_t ScratchBytes(void) const { return mScratch.BytesReserved(); }
   
 
  protected:
 
-  fstream* mInputFstream;
+  // Memory-mapped input file; lines are parsed straight out of it.
+  GHCNMappedFile mInputFile;
+  string mInputName;
 
-  bool mbFileIsOpen;
-  
-  char *mCbuf;
-  char *mCcountry;
-  char *mCstation;
-  char *mCyear;
-  char *mCtemps;
+  // A compressed input file is decompressed by mDecompressor's thread
+  // while the blocks it turns out are parsed (see ParseDecompressed()).
+  // The cache, if any, is keyed on the compressed bytes.
+  GHCN_COMPRESSION mCompression;
+  GHCNDecompressor mDecompressor;
 
-  
-  // GHCN data line format
-  //
-  // (temperature data station ID)
-  //   3-digit country code
-  //   5-digit WMO station number
-  //   3-digit modifier
-  //   1-digit duplicate number
-  //
-  // (data year follows)
-  // 4-digit year
-  //
-  // (temperature samples follow)
-  // 12 5-digit temperature fields
-  // 
-  // (end of line)
-
-  char mId[16]; // Station id info read into mId (more than long enough).
-
-  int mIstation;
-  int mIyear;
-  
-  // WMO station id, year, 12-element temperature vector (1 per month)
-  map<int, map<int, vector<float> > > mTempsMap;
+  // Or the input is a stream ("-", a pipe), which mDecompressor's 
+  // thread reads a block at a time.  Streams are never cached.
+  FILE *mInputStream;
 
-  // Station number, month:  baseline sample count for each individual month
-  // for each station over the baseline interval 1950-1980
-  map<int, map<int, int> > mBaselineSampleCount;
+  // Parse the input via ParseDecompressed() (compressed or a stream).
+  bool mbReadInBlocks;
 
-  // Station number, month: baseline average temperature
-  map<int, map<int,float> > mBaselineTemperature;
+  // Or, when the input named is a directory, the GHCN-Daily station
+  // files (*.dly) in it, in name order.  They're read as one data set,
+  // each file mapped only while it's parsed.
+  vector<string> mDailyFiles;
 
-  // Indexed by year, month -- average global anomalies for each year&month.
-  map<int, vector<double> > mGlobalAverageMonthlyAnomalies;
+  bool mbFileIsOpen;
+
+  int mNumThreads;
+
+  // Files smaller than this aren't worth splitting across threads.
+  static const size_t MIN_CHUNK_BYTES=1<<20;
+
+  // Parsed-data cache.  A cache file is a CacheHeader followed by the
+  // GHCNTempStore image, and is named after the hash of the source
+  // file's contents and the parse flags.  Bump CACHE_VERSION whenever
+  // the header, the store image or the way records are parsed changes.
+  static const uint32_t CACHE_VERSION=5;
+
+  struct CacheHeader
+  {
+    char     magic[8];     // "GHCNSTOR"
+    uint32_t version;      // CACHE_VERSION
+    uint32_t byteOrder;    // 0x01020304 as written by this machine
+    uint64_t sourceHash;   // GHCNHash64 of the source file
+    uint64_t sourceSize;
+    int32_t  minYear;      // MIN_GISS_YEAR the records were cut at
+    int32_t  parseFlags;   // CACHE_KEEP_QC_FLAGGED
+    ParseCounts counts;    // from the parse that made the snapshot
+  };
+
+  // parseFlags bit:  QC-flagged values were kept.
+  static const int32_t CACHE_KEEP_QC_FLAGGED=1;
+
+  // (v2 has no flags, so its snapshots are the same either way.)
+  // Daily snapshots also depend on the element and the minimum days,
+  // which go in the bits above the flag.
+  int32_t CacheParseFlags(void) const
+    { return ((mFormat!=GHCN_FORMAT_V2 && !mbDropQcFlagged) 
+	      ? CACHE_KEEP_QC_FLAGGED : 0)
+	| ((mFormat==GHCN_FORMAT_DAILY) 
+	   ? (mMinDaysPerMonth<<8 | (int)mDailyElement<<1) : 0); }
+
+  string mCacheDir;
+  bool mbLoadedFromCache;
+
+  string CachePath(uint64_t sourceHash);
+  bool  LoadCache(const string& path, uint64_t sourceHash, uint64_t sourceSize);
+  void  SaveCache(const string& path, uint64_t sourceHash, uint64_t sourceSize);
+  
+  // Data line layout of the input file (see GHCNformat.hpp for the
+  // v2, v3 and v4 layouts).
+  GHCN_FORMAT mFormat;
+
+  bool mbDropQcFlagged;
+
+  DAILY_ELEMENT mDailyElement;
+  int mMinDaysPerMonth;
+
+  // Station key, year, 12-element temperature row (1 per month)
+  GHCNTempStore mTemps;
+
+  ParseCounts mCounts;
+
+  DUPLICATE_MODE mDuplicateMode;
+
+  // Average each station's duplicate series into one station keyed by
+  // GHCNStationGroup(), in out (which is finalized).
+  static void CombineDuplicates(const GHCNTempStore& in, GHCNTempStore& out);
+  void  ApplyDuplicateMode(void);
+
+  // Stations with / without at least one month that has enough
+  // baseline samples to be used in the anomaly averages.
+  int mStationsKept;
+  int mStationsDropped;
+
+  // Station index, month:  baseline sample count for each individual month
+  // for each station over the baseline interval (mFirstBaselineYear to
+  // mLastBaselineYear).
+  // Indexed by [12*station-index + month], parallel to mTemps' stations.
+  vector<int> mBaselineSampleCount;
+
+  // Station index, month: baseline average temperature
+  // Indexed by [12*station-index + month].
+  vector<float> mBaselineTemperature;
+
+  int mFirstBaselineYear;
+  int mLastBaselineYear;
+
+  // Window the baseline arrays above were computed for (if valid), and
+  // the arrays for other windows computed earlier.
+  struct BaselineSet
+  {
+    vector<int> count;
+    vector<float> temperature;
+  };
+  pair<int,int> mBaselineWindow;
+  bool mbBaselinesValid;
+  map<pair<int,int>,BaselineSet> mBaselineCache;
+
+  // Running totals of each station's valid monthly temperatures and
+  // how many there are, over its years:  entry k of station is 
+  // (12 months, at 12*(mPrefixStart[is]+k)) covers its first k years.
+  // Empty until BuildBaselinePrefixSums().
+  vector<size_t> mPrefixStart;
+  vector<double> mPrefixSum;
+  vector<int> mPrefixCount;
+
+  void  BuildBaselinePrefixSums(void);
+
+  // StationBaseline() for station is of mTemps, from the running totals.
+  void  PrefixBaseline(int is, int firstYear, int lastYear,
+                       int *count, float *baseline) const;
+
+  // Station subset for ComputeGlobalAverageAnomalies().  The "active"
+  // stations are mSubset if mbUseSubset, otherwise all of mTemps.
+  vector<int> mSubset;
+  bool mbUseSubset;
+
+  int   NumActiveStations(void) const 
+    { return mbUseSubset ? (int)mSubset.size() : mTemps.NumStations(); }
+  int   ActiveStation(int ii) const 
+    { return mbUseSubset ? mSubset[ii] : ii; }
+
+  // Stations per work item when stages are split across threads.
+  static const int STATION_BLOCK=256;
+
+  // First year and number of years covered by the per-year arrays below
+  // (the full year range of all the stations).
+  int mAnomalyFirstYear;
+  int mAnomalyNumYears;
+
+  // Indexed by [12*(year-mAnomalyFirstYear) + month] -- average global 
+  // anomalies for each year&month.
+  vector<double> mGlobalAverageMonthlyAnomalies;
+
+  // Indexed by [12*(year-mAnomalyFirstYear) + month] -- the anomaly sums
+  // the averages come from, kept for incremental updates.
+  vector<double> mAnomalySum;
 
   // Indexed by year -- average global anomalies for each year
   // (merged year&month anomalies).
   map<int, double >  mGlobalAverageAnnualAnomalies;
 
   //  Year, month, station count
-  // number of valid stations per year, month
-  map<int, map<int, int> > mAverageStationCount;
-
-  fstream* openFile(const string& infile);
+  // number of valid stations per year, month.
+  // Indexed by [12*(year-mAnomalyFirstYear) + month].
+  vector<int> mAverageStationCount;
+
+  // Scratch arrays for the anomaly passes, which are rerun for every
+  // query in batch mode.  Reset at the start of each pass.
+  GHCNArena mScratch;
+
+  // Anomaly sums and station counts for a range of years -- one per
+  // block of stations, combined by AddAnomalySums().  The arrays are
+  // in mScratch.
+  struct AnomalySums
+  {
+    double *sum;
+    int *count;
+  };
+
+  void  AccumulateAnomalies(int ii_begin, int ii_end, 
+                            const int& minBaselineSampleCount,
+                            AnomalySums& sums);
+  static void AddAnomalySums(AnomalySums& into, const AnomalySums& from,
+                             size_t n);
+
+  // Add partial[1..nblocks) into partial[0];  n entries in each.
+  template<class Sums>
+  void  ReducePairwise(Sums *partial, int nblocks, size_t n);
+
+  const GHCNInventory *mInventory;
+  const GHCNGrid *mGrid;
+
+  vector<GHCNStationKey> mCountries;   // GHCNCountryKey()s
+  const GHCNRegion *mRegion;
+  int mStationsFilteredOut;
+
+  bool  HasFilter(void) const { return !mCountries.empty() || mRegion!=NULL; }
+  bool  CountrySelected(GHCNStationKey station) const;
+  bool  StationSelected(GHCNStationKey station) const;
+  void  ApplyFilter(void);
+  int mStationsUnlocated;
+  int mGridCellsUsed;
+
+  // Grid cells per work item.
+  static const int CELL_BLOCK=64;
+
+  // Weighted sums of cell-average anomalies, total cell weights and
+  // station counts for a range of years -- one per block of cells.
+  struct GridSums
+  {
+    double *sum;
+    double *weight;
+    int *count;
+  };
+
+  static void AddAnomalySums(GridSums& into, const GridSums& from, size_t n);
+  void  ComputeGriddedAnomalies(const int& minBaselineSampleCount);
+
+  // Parse the GHCN data lines in [begin,end), handing each station-year
+  // to sink(station, year, temps) and adding to counts.
+  template<class Sink>
+  void  ParseLines(const char *begin, const char *end, ParseCounts& counts,
+                   Sink sink);
+
+  // ParseLines() for lines in the given layout.
+  template<class Layout, class Sink>
+  void  ParseLayout(const char *begin, const char *end, ParseCounts& counts,
+                    Sink sink);
+
+  // ParseLines() for GHCN-Daily lines:  the mDailyElement lines of 
+  // each station-year are averaged into one record of monthly means.
+  // A station-year's lines have to be together, as they are in the
+  // .dly files.
+  template<class Sink>
+  void  ParseDaily(const char *begin, const char *end, ParseCounts& counts,
+                   Sink sink);
+
+  // Parse mDailyFiles[first..last) into store.
+  void  ParseDailyFiles(size_t first, size_t last, GHCNTempStore& store,
+                        ParseCounts& counts);
+
+  // ReadTemps() for a directory of .dly files.
+  void  ReadDailyFiles(void);
+
+  // Hand the decompressed input to parse(begin, end) a block at a 
+  // time, then stop the decompression thread.  Exits if the data turns
+  // out to be corrupt.
+  template<class Parse>
+  void  ParseDecompressed(Parse parse);
+
+  // Stop reading mInputStream and close it (unless it's stdin).
+  void  CloseStream(void);
+
+  // Start of the last station-year in [begin,end), for daily data
+  // (whose last station-year may carry on in the next block);  end for
+  // other formats.
+  const char* LastStationYearStart(const char *begin, const char *end) const;
+
+  // Where to split [begin,end) near the line start pp:  for daily
+  // input, pp moved on past the rest of the station-year the line
+  // before it is in, so that no station-year straddles two chunks.
+  // (Other formats have a line per station-year, so pp itself.)
+  const char* StationYearStart(const char *pp, const char *begin,
+                               const char *end) const;
+
+  // Parse the GHCN data lines in [begin,end) into store.
+  void  ParseRecords(const char *begin, const char *end, 
+                     GHCNTempStore& store, ParseCounts& counts);
+
+  static void AddCounts(ParseCounts& into, const ParseCounts& from);
+
+  // Baseline sample counts and average temperatures (12 of each) 
+  // for station is of store, over the years [firstYear,lastYear].
+  static void StationBaseline(const GHCNTempStore& store, int is,
+                              int firstYear, int lastYear,
+                              int *count, float *baseline);
+
+  // Does a station with these 12 baseline sample counts have at least
+  // one month that can go into the anomaly averages?
+  static bool StationQualifies(const int *baselineCount, 
+                               int minBaselineSampleCount);
+
+  // Add the anomalies of station is of store into sum and count, which 
+  // are indexed by [12*(year-firstYear) + month].
+  // With sign=-1 the anomalies are taken back out again.
+  static void StationAnomalies(const GHCNTempStore& store, int is,
+                               const int *baselineCount, const float *baseline,
+                               int minBaselineSampleCount, int firstYear,
+                               double *sum, int *count, int sign=1);
+
+  // Turn the anomaly sums in mAnomalySum into averages over 
+  // mAverageStationCount stations, in mGlobalAverageMonthlyAnomalies.
+  void  AverageAnomalySums(void);
+
+  // Widen the per-year arrays to cover [firstYear,lastYear] too.
+  void  GrowAnomalyYears(int firstYear, int lastYear);
+
+  // Stations in the last ApplyDelta(), and how many of them needed
+  // their baselines recomputing.
+  int mDeltaStations;
+  int mBaselinesRecomputed;
+
+  // -B value the anomaly sums were made with.
+  int mStateMinBaselineSampleCount;
+
+  void  CountStationsKept(int minBaselineSampleCount);
+
+  // Incremental-update state file.  The header is followed by the store
+  // image, then the baseline counts and temperatures (12 per station),
+  // then the anomaly sums and counts (12 per year), each array padded
+  // to 8 bytes.
+  static const uint32_t STATE_VERSION=2;
+
+  struct StateHeader
+  {
+    char     magic[8];     // "GHCNSTAT"
+    uint32_t version;      // STATE_VERSION
+    uint32_t byteOrder;    // 0x01020304 as written by this machine
+    int32_t  minYear;      // MIN_GISS_YEAR
+    int32_t  firstBaselineYear;
+    int32_t  lastBaselineYear;
+    int32_t  minBaselineSampleCount;
+    int32_t  duplicateMode;
+    int32_t  anomalyFirstYear;
+    int32_t  anomalyNumYears;
+    int32_t  reserved;
+    uint64_t storeBytes;   // size of the store image
+  };
   
 };
 
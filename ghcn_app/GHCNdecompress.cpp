@@ -0,0 +1,1154 @@
+#include "GHCNdecompress.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+using namespace std;
+
+
+GHCN_COMPRESSION GHCNDetectCompression(const char *data, size_t size)
+{
+  if(size>=2 && (unsigned char)data[0]==0x1f)
+  {
+    if((unsigned char)data[1]==0x9d)
+    {
+      return GHCN_COMPRESSION_LZW;
+    }
+    if((unsigned char)data[1]==0x8b)
+    {
+      return GHCN_COMPRESSION_GZIP;
+    }
+  }
+  return GHCN_COMPRESSION_NONE;
+}
+
+const char* GHCNCompressionName(GHCN_COMPRESSION compression)
+{
+  switch(compression)
+  {
+    case GHCN_COMPRESSION_LZW:
+      return "compress";
+    case GHCN_COMPRESSION_GZIP:
+      return "gzip";
+    default:
+      return "none";
+  }
+}
+
+
+namespace
+{
+
+// Decoded bytes are passed to out(data, n) in pieces;  out returns
+// false if it doesn't want any more, which stops the decoder.
+
+//
+// .Z:  a 3-byte header (1f 9d, then the maximum code size and the
+// block-mode flag), then LZW codes packed LSB first, starting at 9
+// bits.  The codes come in groups of 8 (one group is `bits' bytes),
+// and when the code size changes, or the table is cleared, the rest
+// of the current group is padding.  This follows ncompress's decoder.
+//
+template<class Out>
+bool DecodeLzw(const unsigned char *in, size_t size, Out& out, string& error)
+{
+  static const unsigned CLEAR=256;
+  static const size_t OUT_BYTES=1<<16;
+
+  if(size<3)
+  {
+    error="truncated .Z header";
+    return false;
+  }
+  int maxbits=in[2]&0x1f;
+  bool blockMode=(in[2]&0x80)!=0;
+  if(maxbits<9 || maxbits>16)
+  {
+    error="bad .Z code size";
+    return false;
+  }
+
+  const unsigned char *codes=in+3;
+  uint64_t nbits=(uint64_t)(size-3)*8;
+  unsigned maxmaxcode=1u<<maxbits;
+
+  vector<uint16_t> prefix(maxmaxcode);
+  vector<unsigned char> suffix(maxmaxcode);
+  vector<unsigned char> stack(maxmaxcode+1);
+  vector<unsigned char> obuf(OUT_BYTES);
+  size_t olen=0;
+  for(unsigned cc=0; cc<256; cc++)
+  {
+    suffix[cc]=(unsigned char)cc;
+  }
+
+  int bits=9;
+  unsigned mask=(1u<<bits)-1;
+  unsigned maxcode=mask;
+  unsigned freeEnt = blockMode ? CLEAR+1 : CLEAR;
+  uint64_t pos=0;
+  uint64_t groupStart=0;
+  int oldcode=-1;
+  unsigned finchar=0;
+
+  // Skip the rest of the current group of codes.
+  auto endGroup=[&]()
+  {
+    uint64_t groupBits=8*(uint64_t)bits;
+    pos=groupStart+(pos-groupStart+groupBits-1)/groupBits*groupBits;
+    groupStart=pos;
+  };
+
+  for(;;)
+  {
+    if(freeEnt>maxcode)
+    {
+      endGroup();
+      bits++;
+      mask=(1u<<bits)-1;
+      maxcode = (bits==maxbits) ? maxmaxcode : mask;
+      continue;
+    }
+
+    if(pos+bits>nbits)
+    {
+      break;
+    }
+    size_t ib=(size_t)(pos>>3);
+    uint32_t word=codes[ib];
+    if(ib+1<size-3)
+    {
+      word|=(uint32_t)codes[ib+1]<<8;
+    }
+    if(ib+2<size-3)
+    {
+      word|=(uint32_t)codes[ib+2]<<16;
+    }
+    unsigned code=(word>>(pos&7))&mask;
+    pos+=bits;
+
+    if(oldcode<0)
+    {
+      if(code>=256)
+      {
+	error="bad first code in .Z data";
+	return false;
+      }
+      oldcode=(int)code;
+      finchar=code;
+      obuf[olen++]=(unsigned char)code;
+      continue;
+    }
+
+    if(code==CLEAR && blockMode)
+    {
+      // (The entry the next code makes is 256, which is never used.)
+      freeEnt=CLEAR;
+      endGroup();
+      bits=9;
+      mask=(1u<<bits)-1;
+      maxcode=mask;
+      continue;
+    }
+
+    // Unwind the code's string onto the stack, backwards.
+    unsigned incode=code;
+    size_t sp=stack.size();
+    if(code>=freeEnt)
+    {
+      // The string being defined by this very code (KwKwK).
+      if(code>freeEnt)
+      {
+	error="corrupt .Z data";
+	return false;
+      }
+      stack[--sp]=(unsigned char)finchar;
+      code=(unsigned)oldcode;
+    }
+    while(code>=256)
+    {
+      if(sp==1)
+      {
+	error="corrupt .Z data";
+	return false;
+      }
+      stack[--sp]=suffix[code];
+      code=prefix[code];
+    }
+    finchar=suffix[code];
+    stack[--sp]=(unsigned char)finchar;
+
+    size_t nn=stack.size()-sp;
+    if(olen+nn>obuf.size())
+    {
+      if(!out(obuf.data(), olen))
+      {
+	return false;
+      }
+      olen=0;
+      if(nn>obuf.size())
+      {
+	obuf.resize(nn);
+      }
+    }
+    memcpy(&obuf[olen], &stack[sp], nn);
+    olen+=nn;
+
+    if(freeEnt<maxmaxcode)
+    {
+      prefix[freeEnt]=(uint16_t)oldcode;
+      suffix[freeEnt]=(unsigned char)finchar;
+      freeEnt++;
+    }
+    oldcode=(int)incode;
+  }
+
+  return olen==0 || out(obuf.data(), olen);
+}
+
+
+//
+// gzip:  one or more members, each a header, a raw deflate stream
+// (RFC 1951) and a CRC-32 and length of the decoded data.
+//
+
+// LSB-first bit reader.  Reading past the end gives zero bits;
+// Overrun() says whether any of those got used.
+class BitReader
+{
+ public:
+
+  BitReader(const unsigned char *data, size_t size)
+  {
+    mStart=data;
+    mPos=data;
+    mEnd=data+size;
+    mBuf=0;
+    mCount=0;
+    mPadBytes=0;
+  }
+
+  void  Refill(void)
+  {
+    while(mCount<=56)
+    {
+      if(mPos<mEnd)
+      {
+	mBuf|=(uint64_t)*mPos++<<mCount;
+      }
+      else
+      {
+	mPadBytes++;
+      }
+      mCount+=8;
+    }
+  }
+
+  // Next n (<= 32) bits, without / with moving past them.
+  unsigned Peek(int n)
+  {
+    if(mCount<n)
+    {
+      Refill();
+    }
+    return (unsigned)(mBuf&((1ull<<n)-1));
+  }
+  void  Skip(int n) { mBuf>>=n; mCount-=n; }
+  unsigned Bits(int n)
+  {
+    unsigned vv=Peek(n);
+    Skip(n);
+    return vv;
+  }
+
+  void  AlignToByte(void) { Skip(mCount&7); }
+
+  // Bytes read so far, counting only whole bytes taken out.
+  size_t Offset(void) const
+    { return (size_t)(mPos-mStart)+mPadBytes-mCount/8; }
+
+  bool  Overrun(void) const { return Offset()>(size_t)(mEnd-mStart); }
+
+  // Copy n bytes straight out of the input (after AlignToByte()).
+  bool  CopyBytes(unsigned char *dest, size_t n)
+  {
+    while(n>0 && mCount>=8)
+    {
+      *dest++=(unsigned char)Bits(8);
+      n--;
+    }
+    if(n>(size_t)(mEnd-mPos))
+    {
+      return false;
+    }
+    memcpy(dest, mPos, n);
+    mPos+=n;
+    return true;
+  }
+
+ protected:
+
+  const unsigned char *mStart;
+  const unsigned char *mPos;
+  const unsigned char *mEnd;
+  uint64_t mBuf;
+  int mCount;
+  size_t mPadBytes;
+};
+
+// Canonical Huffman code.  Codes up to FAST_BITS long are looked up
+// in one go;  longer ones are decoded a bit at a time.
+class Huffman
+{
+ public:
+
+  static const int MAX_BITS=15;
+  static const int FAST_BITS=10;
+
+  // False if the lengths over-subscribe the code.
+  bool  Build(const unsigned char *lengths, int n)
+  {
+    memset(mCount, 0, sizeof(mCount));
+    for(int is=0; is<n; is++)
+    {
+      mCount[lengths[is]]++;
+    }
+    mCount[0]=0;
+
+    int left=1;
+    for(int len=1; len<=MAX_BITS; len++)
+    {
+      left<<=1;
+      left-=mCount[len];
+      if(left<0)
+      {
+	return false;
+      }
+    }
+
+    int offset[MAX_BITS+2];
+    offset[1]=0;
+    for(int len=1; len<=MAX_BITS; len++)
+    {
+      offset[len+1]=offset[len]+mCount[len];
+    }
+    for(int is=0; is<n; is++)
+    {
+      if(lengths[is]!=0)
+      {
+	mSymbol[offset[lengths[is]]++]=(uint16_t)is;
+      }
+    }
+
+    // Fast table:  indexed by the next FAST_BITS input bits, which hold
+    // the code bit-reversed (deflate packs codes MSB first).
+    memset(mFast, 0, sizeof(mFast));
+    unsigned code=0;
+    int index=0;
+    for(int len=1; len<=FAST_BITS; len++)
+    {
+      for(int ic=0; ic<mCount[len]; ic++, code++, index++)
+      {
+	unsigned rev=0;
+	for(int ib=0; ib<len; ib++)
+	{
+	  rev|=((code>>ib)&1)<<(len-1-ib);
+	}
+	for(unsigned ie=rev; ie<(1u<<FAST_BITS); ie+=1u<<len)
+	{
+	  mFast[ie]=mSymbol[index] | (uint32_t)len<<16;
+	}
+      }
+      code<<=1;
+    }
+    return true;
+  }
+
+  // Next symbol, or -1 for a code that isn't in the table.
+  int   Decode(BitReader& br) const
+  {
+    uint32_t entry=mFast[br.Peek(FAST_BITS)];
+    if(entry!=0)
+    {
+      br.Skip((int)(entry>>16));
+      return (int)(entry&0xffff);
+    }
+
+    int code=0;
+    int first=0;
+    int index=0;
+    for(int len=1; len<=MAX_BITS; len++)
+    {
+      code|=(int)br.Bits(1);
+      int count=mCount[len];
+      if(code-count<first)
+      {
+	return mSymbol[index+(code-first)];
+      }
+      index+=count;
+      first+=count;
+      first<<=1;
+      code<<=1;
+    }
+    return -1;
+  }
+
+ protected:
+
+  uint16_t mCount[MAX_BITS+1];
+  uint16_t mSymbol[288];
+  uint32_t mFast[1<<FAST_BITS];   // symbol | length<<16;  0 = longer
+};
+
+struct Crc32Table
+{
+  uint32_t entry[256];
+
+  Crc32Table()
+  {
+    for(uint32_t ii=0; ii<256; ii++)
+    {
+      uint32_t cc=ii;
+      for(int ib=0; ib<8; ib++)
+      {
+	cc = (cc&1) ? 0xedb88320u^(cc>>1) : cc>>1;
+      }
+      entry[ii]=cc;
+    }
+  }
+};
+
+uint32_t Crc32(uint32_t crc, const unsigned char *data, size_t n)
+{
+  static const Crc32Table table;
+
+  crc=~crc;
+  for(size_t ii=0; ii<n; ii++)
+  {
+    crc=table.entry[(crc^data[ii])&0xff]^(crc>>8);
+  }
+  return ~crc;
+}
+
+// The last 32K of output (what deflate's distances can reach back
+// into), plus room for new output, which is passed on when it fills.
+template<class Out>
+class InflateWindow
+{
+ public:
+
+  static const size_t WINDOW_BYTES=32768;
+  static const size_t MAX_MATCH=258;
+
+  InflateWindow(Out& out) : mOut(out), mBuf(WINDOW_BYTES+(256<<10))
+  {
+    mPos=0;
+    mFlushed=0;
+    mTotal=0;
+    mCrc=0;
+  }
+
+  // Make room for a literal or a match.
+  bool  Reserve(void)
+  {
+    if(mPos+MAX_MATCH<=mBuf.size())
+    {
+      return true;
+    }
+    if(!Flush())
+    {
+      return false;
+    }
+    memmove(&mBuf[0], &mBuf[mPos-WINDOW_BYTES], WINDOW_BYTES);
+    mPos=WINDOW_BYTES;
+    mFlushed=mPos;
+    return true;
+  }
+
+  void  Literal(int cc) { mBuf[mPos++]=(unsigned char)cc; mTotal++; }
+
+  // False if dist reaches back before the start of the data.
+  bool  Match(size_t len, size_t dist)
+  {
+    if(dist>mTotal || dist>WINDOW_BYTES)
+    {
+      return false;
+    }
+    unsigned char *dest=&mBuf[mPos];
+    const unsigned char *src=dest-dist;
+    if(dist>=len)
+    {
+      memcpy(dest, src, len);
+    }
+    else
+    {
+      for(size_t ii=0; ii<len; ii++)
+      {
+	dest[ii]=src[ii];
+      }
+    }
+    mPos+=len;
+    mTotal+=len;
+    return true;
+  }
+
+  // Stored-block bytes, straight from the input.
+  bool  Stored(BitReader& br, size_t len)
+  {
+    while(len>0)
+    {
+      if(!Reserve())
+      {
+	return false;
+      }
+      size_t nn=min(len, mBuf.size()-mPos);
+      if(!br.CopyBytes(&mBuf[mPos], nn))
+      {
+	return false;
+      }
+      mPos+=nn;
+      mTotal+=nn;
+      len-=nn;
+    }
+    return true;
+  }
+
+  bool  Flush(void)
+  {
+    size_t nn=mPos-mFlushed;
+    if(nn==0)
+    {
+      return true;
+    }
+    mCrc=Crc32(mCrc, &mBuf[mFlushed], nn);
+    mFlushed=mPos;
+    return mOut(&mBuf[mPos-nn], nn);
+  }
+
+  uint64_t Total(void) const { return mTotal; }
+  uint32_t Crc(void) const { return mCrc; }
+
+ protected:
+
+  Out& mOut;
+  vector<unsigned char> mBuf;
+  size_t mPos;
+  size_t mFlushed;
+  uint64_t mTotal;
+  uint32_t mCrc;
+};
+
+// Literal/length and distance codes of one compressed block.
+template<class Out>
+bool InflateCodes(BitReader& br, const Huffman& litlen, const Huffman& dist,
+                  InflateWindow<Out>& window, string& error)
+{
+  static const uint16_t LEN_BASE[29]=
+    { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+  static const uint8_t LEN_EXTRA[29]=
+    { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+  static const uint16_t DIST_BASE[30]=
+    { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+      257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+      8193, 12289, 16385, 24577 };
+  static const uint8_t DIST_EXTRA[30]=
+    { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+      7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+  for(;;)
+  {
+    int sym=litlen.Decode(br);
+    if(sym<256)
+    {
+      if(sym<0)
+      {
+	error="bad literal/length code in gzip data";
+	return false;
+      }
+      if(!window.Reserve())
+      {
+	return false;
+      }
+      window.Literal(sym);
+    }
+    else if(sym==256)
+    {
+      return true;
+    }
+    else
+    {
+      sym-=257;
+      if(sym>=29)
+      {
+	error="bad length code in gzip data";
+	return false;
+      }
+      size_t len=LEN_BASE[sym]+br.Bits(LEN_EXTRA[sym]);
+
+      int dsym=dist.Decode(br);
+      if(dsym<0 || dsym>=30)
+      {
+	error="bad distance code in gzip data";
+	return false;
+      }
+      size_t dd=DIST_BASE[dsym]+br.Bits(DIST_EXTRA[dsym]);
+
+      if(!window.Reserve())
+      {
+	return false;
+      }
+      if(!window.Match(len, dd))
+      {
+	error="distance too far back in gzip data";
+	return false;
+      }
+    }
+
+    if(br.Overrun())
+    {
+      error="truncated gzip data";
+      return false;
+    }
+  }
+}
+
+// The code tables of a dynamic block.
+bool ReadDynamicTables(BitReader& br, Huffman& litlen, Huffman& dist,
+                       string& error)
+{
+  static const uint8_t ORDER[19]=
+    { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+  int nlen=(int)br.Bits(5)+257;
+  int ndist=(int)br.Bits(5)+1;
+  int ncode=(int)br.Bits(4)+4;
+  if(nlen>286 || ndist>30)
+  {
+    error="bad code counts in gzip data";
+    return false;
+  }
+
+  unsigned char lengths[286+30];
+  memset(lengths, 0, 19);
+  for(int ii=0; ii<ncode; ii++)
+  {
+    lengths[ORDER[ii]]=(unsigned char)br.Bits(3);
+  }
+  Huffman lencode;
+  if(!lencode.Build(lengths, 19))
+  {
+    error="bad code-length code in gzip data";
+    return false;
+  }
+
+  int ii=0;
+  while(ii<nlen+ndist)
+  {
+    int sym=lencode.Decode(br);
+    if(sym<0)
+    {
+      error="bad code length in gzip data";
+      return false;
+    }
+    if(sym<16)
+    {
+      lengths[ii++]=(unsigned char)sym;
+      continue;
+    }
+
+    int repeat;
+    unsigned char len=0;
+    if(sym==16)
+    {
+      if(ii==0)
+      {
+	error="bad code-length repeat in gzip data";
+	return false;
+      }
+      len=lengths[ii-1];
+      repeat=3+(int)br.Bits(2);
+    }
+    else if(sym==17)
+    {
+      repeat=3+(int)br.Bits(3);
+    }
+    else
+    {
+      repeat=11+(int)br.Bits(7);
+    }
+    if(ii+repeat>nlen+ndist)
+    {
+      error="too many code lengths in gzip data";
+      return false;
+    }
+    while(repeat-->0)
+    {
+      lengths[ii++]=len;
+    }
+  }
+
+  if(lengths[256]==0)
+  {
+    error="no end-of-block code in gzip data";
+    return false;
+  }
+  if(!litlen.Build(lengths, nlen) || !dist.Build(lengths+nlen, ndist))
+  {
+    error="bad code lengths in gzip data";
+    return false;
+  }
+  return true;
+}
+
+// The codes of a fixed-code block.
+struct FixedCodes
+{
+  Huffman litlen;
+  Huffman dist;
+
+  FixedCodes()
+  {
+    unsigned char lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths+144, 9, 256-144);
+    memset(lengths+256, 7, 280-256);
+    memset(lengths+280, 8, 288-280);
+    litlen.Build(lengths, 288);
+    memset(lengths, 5, 30);
+    dist.Build(lengths, 30);
+  }
+};
+
+// One raw deflate stream.
+template<class Out>
+bool Inflate(BitReader& br, InflateWindow<Out>& window, string& error)
+{
+  static const FixedCodes fixed;
+
+  Huffman litlen;
+  Huffman dist;
+  bool last;
+  do
+  {
+    last=br.Bits(1)!=0;
+    int type=(int)br.Bits(2);
+
+    if(type==0)
+    {
+      br.AlignToByte();
+      unsigned len=br.Bits(16);
+      unsigned nlen=br.Bits(16);
+      if(len!=(~nlen&0xffff))
+      {
+	error="bad stored block in gzip data";
+	return false;
+      }
+      if(!window.Stored(br, len))
+      {
+	if(error.empty())
+	{
+	  error="truncated gzip data";
+	}
+	return false;
+      }
+    }
+    else if(type==1)
+    {
+      if(!InflateCodes(br, fixed.litlen, fixed.dist, window, error))
+      {
+	return false;
+      }
+    }
+    else if(type==2)
+    {
+      if(!ReadDynamicTables(br, litlen, dist, error)
+	 || !InflateCodes(br, litlen, dist, window, error))
+      {
+	return false;
+      }
+    }
+    else
+    {
+      error="bad block type in gzip data";
+      return false;
+    }
+  } while(!last);
+
+  return window.Flush();
+}
+
+template<class Out>
+bool DecodeGzip(const unsigned char *in, size_t size, Out& out, string& error)
+{
+  static const int FHCRC=0x02, FEXTRA=0x04, FNAME=0x08, FCOMMENT=0x10;
+
+  size_t offset=0;
+  bool first=true;
+
+  // Members follow one another;  anything after the last one that
+  // isn't a gzip header is ignored (as gzip does).
+  while(offset+2<=size && in[offset]==0x1f && in[offset+1]==0x8b)
+  {
+    const unsigned char *hdr=in+offset;
+    size_t left=size-offset;
+    if(left<10 || hdr[2]!=8)
+    {
+      error = left<10 ? "truncated gzip header" : "unknown gzip method";
+      return false;
+    }
+
+    int flags=hdr[3];
+    size_t pos=10;
+    if(flags & FEXTRA)
+    {
+      if(pos+2>left)
+      {
+	error="truncated gzip header";
+	return false;
+      }
+      pos+=2+(hdr[pos] | (size_t)hdr[pos+1]<<8);
+    }
+    if(flags & FNAME)
+    {
+      while(pos<left && hdr[pos]!=0)
+      {
+	pos++;
+      }
+      pos++;
+    }
+    if(flags & FCOMMENT)
+    {
+      while(pos<left && hdr[pos]!=0)
+      {
+	pos++;
+      }
+      pos++;
+    }
+    if(flags & FHCRC)
+    {
+      pos+=2;
+    }
+    if(pos>left)
+    {
+      error="truncated gzip header";
+      return false;
+    }
+
+    BitReader br(hdr+pos, left-pos);
+    InflateWindow<Out> window(out);
+    if(!Inflate(br, window, error))
+    {
+      return false;
+    }
+
+    br.AlignToByte();
+    uint32_t crc=br.Bits(16);
+    crc|=br.Bits(16)<<16;
+    uint32_t isize=br.Bits(16);
+    isize|=br.Bits(16)<<16;
+    if(br.Overrun())
+    {
+      error="truncated gzip data";
+      return false;
+    }
+    if(crc!=window.Crc() || isize!=(uint32_t)window.Total())
+    {
+      error="gzip data fails its CRC check";
+      return false;
+    }
+
+    offset+=pos+br.Offset();
+    first=false;
+  }
+
+  if(first)
+  {
+    error="not gzip data";
+    return false;
+  }
+  return true;
+}
+
+}
+
+
+// (Defined as well as declared, since std::max() takes them by
+// reference.)
+const size_t GHCNDecompressor::BLOCK_BYTES;
+const int GHCNDecompressor::NUM_BLOCKS;
+const size_t GHCNDecompressor::READ_BYTES;
+
+GHCNDecompressor::GHCNDecompressor()
+{
+  mConsuming=-1;
+  mbPeeked=false;
+  mbDone=true;
+  mbStopping=false;
+  mCompression=GHCN_COMPRESSION_NONE;
+}
+
+GHCNDecompressor::~GHCNDecompressor()
+{
+  Stop();
+}
+
+void GHCNDecompressor::Start(const char *data, size_t size,
+                             GHCN_COMPRESSION compression)
+{
+  Reset();
+  mCompression=compression;
+  mThread=thread(&GHCNDecompressor::Produce, this, data, size, compression,
+                 (FILE*)NULL);
+}
+
+void GHCNDecompressor::Start(FILE *fp)
+{
+  Reset();
+  mThread=thread(&GHCNDecompressor::Produce, this, (const char*)NULL, 
+                 (size_t)0, GHCN_COMPRESSION_NONE, fp);
+}
+
+void GHCNDecompressor::Reset(void)
+{
+  Stop();
+
+  mFree.clear();
+  mFilled.clear();
+  for(int ib=0; ib<NUM_BLOCKS; ib++)
+  {
+    mBlocks[ib].used=0;
+    mFree.push_back(ib);
+  }
+  mConsuming=-1;
+  mbPeeked=false;
+  mbDone=false;
+  mbStopping=false;
+  mError.clear();
+  mCompression=GHCN_COMPRESSION_NONE;
+}
+
+void GHCNDecompressor::Stop(void)
+{
+  {
+    lock_guard<mutex> lock(mMutex);
+    mbStopping=true;
+  }
+  mChanged.notify_all();
+  if(mThread.joinable())
+  {
+    mThread.join();
+  }
+  mbDone=true;
+}
+
+bool GHCNDecompressor::NextBlock(const char*& begin, const char*& end)
+{
+  unique_lock<mutex> lock(mMutex);
+
+  if(mbPeeked)
+  {
+    mbPeeked=false;
+  }
+  else
+  {
+    if(mConsuming>=0)
+    {
+      mFree.push_back(mConsuming);
+      mConsuming=-1;
+      mChanged.notify_all();
+    }
+    mChanged.wait(lock, [&]() { return !mFilled.empty() || mbDone; });
+    if(mFilled.empty())
+    {
+      return false;
+    }
+    mConsuming=mFilled.front();
+    mFilled.pop_front();
+  }
+
+  begin=mBlocks[mConsuming].data.data();
+  end=begin+mBlocks[mConsuming].used;
+  return true;
+}
+
+bool GHCNDecompressor::PeekBlock(const char*& begin, const char*& end)
+{
+  if(mbPeeked)
+  {
+    begin=mBlocks[mConsuming].data.data();
+    end=begin+mBlocks[mConsuming].used;
+    return true;
+  }
+  if(!NextBlock(begin, end))
+  {
+    return false;
+  }
+  mbPeeked=true;
+  return true;
+}
+
+int GHCNDecompressor::TakeFree(void)
+{
+  unique_lock<mutex> lock(mMutex);
+  mChanged.wait(lock, [&]() { return !mFree.empty() || mbStopping; });
+  if(mbStopping)
+  {
+    return -1;
+  }
+  int ib=mFree.front();
+  mFree.pop_front();
+  return ib;
+}
+
+void GHCNDecompressor::Queue(int ib)
+{
+  {
+    lock_guard<mutex> lock(mMutex);
+    mFilled.push_back(ib);
+  }
+  mChanged.notify_all();
+}
+
+void GHCNDecompressor::Produce(const char *data, size_t size,
+                               GHCN_COMPRESSION compression, FILE *fp)
+{
+  int cur=TakeFree();
+
+  // Decoded bytes go into the current block.  When it fills, it's
+  // passed on up to its last newline, and the cut-off line starts the
+  // next one.  (A block with no newline in it at all just grows.)
+  auto put=[&](const unsigned char *pp, size_t nn) -> bool
+  {
+    while(nn>0)
+    {
+      Block& block=mBlocks[cur];
+      if(block.data.size()<BLOCK_BYTES)
+      {
+	block.data.resize(BLOCK_BYTES);
+      }
+
+      if(block.used==block.data.size())
+      {
+	const char *start=block.data.data();
+	const char *eol=start+block.used;
+	while(eol>start && eol[-1]!='\n')
+	{
+	  eol--;
+	}
+	if(eol==start)
+	{
+	  block.data.resize(2*block.data.size());
+	  continue;
+	}
+
+	int next=TakeFree();
+	if(next<0)
+	{
+	  return false;
+	}
+	Block& nextBlock=mBlocks[next];
+	size_t carry=block.used-(eol-start);
+	nextBlock.data.resize(max(BLOCK_BYTES, 2*carry));
+	memcpy(nextBlock.data.data(), eol, carry);
+	nextBlock.used=carry;
+	block.used-=carry;
+	Queue(cur);
+	cur=next;
+	continue;
+      }
+
+      size_t ncopy=min(nn, block.data.size()-block.used);
+      memcpy(&block.data[block.used], pp, ncopy);
+      block.used+=ncopy;
+      pp+=ncopy;
+      nn-=ncopy;
+    }
+    return true;
+  };
+
+  string error;
+  bool ok=false;
+  vector<char> buffer;
+  if(cur>=0 && fp!=NULL)
+  {
+    // The first read says what the stream is.
+    buffer.resize(READ_BYTES);
+    size_t nread=fread(buffer.data(), 1, buffer.size(), fp);
+    compression=GHCNDetectCompression(buffer.data(), nread);
+    {
+      lock_guard<mutex> lock(mMutex);
+      mCompression=compression;
+    }
+
+    if(compression==GHCN_COMPRESSION_NONE)
+    {
+      // Each read lands in the current block while the consumer works
+      // through the one before.
+      ok=true;
+      while(ok && nread>0)
+      {
+	ok=put((const unsigned char*)buffer.data(), nread);
+	nread=fread(buffer.data(), 1, buffer.size(), fp);
+      }
+    }
+    else
+    {
+      // The decoders want all their input at once;  it's the small,
+      // compressed side, so just collect it.
+      size=nread;
+      while(nread>0)
+      {
+	if(size==buffer.size())
+	{
+	  buffer.resize(2*buffer.size());
+	}
+	nread=fread(&buffer[size], 1, buffer.size()-size, fp);
+	size+=nread;
+      }
+      data=buffer.data();
+    }
+
+    if(ferror(fp))
+    {
+      ok=false;
+      compression=GHCN_COMPRESSION_NONE;
+      error="read error";
+    }
+  }
+
+  if(cur>=0 && (fp==NULL || compression!=GHCN_COMPRESSION_NONE))
+  {
+    const unsigned char *in=(const unsigned char*)data;
+    if(compression==GHCN_COMPRESSION_LZW)
+    {
+      ok=DecodeLzw(in, size, put, error);
+    }
+    else if(compression==GHCN_COMPRESSION_GZIP)
+    {
+      ok=DecodeGzip(in, size, put, error);
+    }
+    else
+    {
+      ok=put(in, size);
+    }
+  }
+
+  if(cur>=0 && mBlocks[cur].used>0)
+  {
+    Queue(cur);
+  }
+
+  {
+    lock_guard<mutex> lock(mMutex);
+    if(!ok && !mbStopping)
+    {
+      mError = error.empty() ? string("decompression failed") : error;
+    }
+    mbDone=true;
+  }
+  mChanged.notify_all();
+}
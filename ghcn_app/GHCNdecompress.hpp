@@ -0,0 +1,121 @@
+#ifndef GHCNDECOMPRESS_HPP
+#define GHCNDECOMPRESS_HPP
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//
+// Compressed input:  decoders for .Z (Unix compress, LZW) and .gz
+// (gzip, deflate) files that need no outside libraries, and a reader
+// that runs one in a producer thread, so that lines can be parsed
+// while the rest of the file is still being decompressed.
+//
+
+enum GHCN_COMPRESSION { GHCN_COMPRESSION_NONE, GHCN_COMPRESSION_LZW,
+                        GHCN_COMPRESSION_GZIP };
+
+// From the magic number at the start of the data.
+GHCN_COMPRESSION GHCNDetectCompression(const char *data, size_t size);
+
+const char* GHCNCompressionName(GHCN_COMPRESSION compression);
+
+
+// Decompresses a block of compressed data in its own thread, handing
+// out the result a block at a time.  Blocks always end on a line
+// boundary:  a line cut off at the end of one is carried over to the
+// start of the next, so each block can be parsed on its own.  Only a
+// few blocks are ever in memory;  the producer waits for the consumer
+// to hand one back before decoding more.
+//
+// The same thread can read a stream (standard input, a pipe) instead:
+// one block is filled by large reads while the one before it is being
+// parsed.
+class GHCNDecompressor
+{
+ public:
+
+  GHCNDecompressor();
+  virtual ~GHCNDecompressor();   // stops the thread
+
+  // Start decompressing [data,data+size), which has to stay valid
+  // until the last block has been handed out, or Stop().
+  void  Start(const char *data, size_t size, GHCN_COMPRESSION compression);
+
+  // Read fp to the end instead, decompressing it if it starts with a
+  // .Z or .gz magic number.  fp has to stay open until the last block
+  // has been handed out, or Stop().
+  void  Start(FILE *fp);
+
+  // What the data turned out to be;  for a stream, valid once
+  // PeekBlock() or NextBlock() has returned.
+  GHCN_COMPRESSION Compression(void) const { return mCompression; }
+
+  // The next block of decompressed data, valid until the next call.
+  // Returns false when there's no more.
+  bool  NextBlock(const char*& begin, const char*& end);
+
+  // The block that NextBlock() will return next, without moving on.
+  bool  PeekBlock(const char*& begin, const char*& end);
+
+  // Stop the thread (early, if it's still going) and wait for it.
+  void  Stop(void);
+
+  // Once NextBlock() has returned false:  why decoding stopped short
+  // (bad or truncated data), or empty if it didn't.
+  const std::string& Error(void) const { return mError; }
+
+ protected:
+
+  static const size_t BLOCK_BYTES=4<<20;
+  static const int NUM_BLOCKS=3;
+  static const size_t READ_BYTES=1<<20;   // per read() from a stream
+
+  struct Block
+  {
+    std::vector<char> data;
+    size_t used;
+  };
+  Block mBlocks[NUM_BLOCKS];
+
+  // Blocks free for the producer, and filled ones waiting for the
+  // consumer, in order;  the consumer holds mConsuming (or -1).
+  std::deque<int> mFree;
+  std::deque<int> mFilled;
+  int mConsuming;
+  bool mbPeeked;
+
+  bool mbDone;       // producer has finished
+  bool mbStopping;   // consumer wants the producer to give up
+  std::string mError;
+  GHCN_COMPRESSION mCompression;
+
+  std::mutex mMutex;
+  std::condition_variable mChanged;
+  std::thread mThread;
+
+  // Empty the queues for a new Start().
+  void  Reset(void);
+
+  // Decode [data,data+size), or read fp if it isn't NULL.
+  void  Produce(const char *data, size_t size, GHCN_COMPRESSION compression,
+                FILE *fp);
+
+  // Producer side:  a free block (-1 if stopping), and passing a
+  // filled one on.
+  int   TakeFree(void);
+  void  Queue(int ib);
+
+ private:
+  GHCNDecompressor(const GHCNDecompressor&);
+  GHCNDecompressor& operator=(const GHCNDecompressor&);
+
+};
+
+#endif // GHCNDECOMPRESS_HPP
@@ -0,0 +1,92 @@
+#include "GHCNformat.hpp"
+
+#include <string.h>
+
+
+static bool AllDigits(const char *pp, int nn)
+{
+  for(int ii=0; ii<nn; ii++)
+  {
+    if((unsigned)(pp[ii]-'0')>9)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool AllLetters(const char *pp, int nn)
+{
+  for(int ii=0; ii<nn; ii++)
+  {
+    if((unsigned)(pp[ii]-'A')>25)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+GHCN_FORMAT GHCNDetectFormat(const char *data, size_t size)
+{
+  const char *end=data+size;
+  const char *eol;
+  for(const char *line=data; line<end; line=eol+1)
+  {
+    eol=(const char*)memchr(line, '\n', end-line);
+    if(eol==NULL)
+    {
+      eol=end;
+    }
+
+    int len=(int)(eol-line);
+    while(len>0 && (line[len-1]=='\r' || line[len-1]==' '))
+    {
+      len--;
+    }
+    if(len==0)
+    {
+      continue;
+    }
+
+    // Daily:  a 4-digit year and 2-digit month straight after the 
+    // 11-character ID, then the element name.
+    if(len>=GHCNLayoutDaily::DAYS_COL
+       && AllDigits(line+GHCNLayoutDaily::YEAR_COL, 
+		    GHCNLayoutDaily::ELEMENT_COL-GHCNLayoutDaily::YEAR_COL)
+       && AllLetters(line+GHCNLayoutDaily::ELEMENT_COL, 4))
+    {
+      return GHCN_FORMAT_DAILY;
+    }
+
+    // v3/v4:  a 4-digit year straight after the 11-character ID, then
+    // the element name.  In a v2 line those columns are the end of the
+    // year and the first value, which are never letters.
+    if(len<GHCNLayoutV3::TEMPS_COL
+       || !AllDigits(line+GHCNLayoutV3::YEAR_COL, 4)
+       || !AllLetters(line+GHCNLayoutV3::ELEMENT_COL, 4))
+    {
+      return GHCN_FORMAT_V2;
+    }
+
+    return AllDigits(line, GHCNLayoutV3::YEAR_COL) ? GHCN_FORMAT_V3 
+                                                   : GHCN_FORMAT_V4;
+  }
+
+  return GHCN_FORMAT_V2;
+}
+
+const char* GHCNFormatName(GHCN_FORMAT format)
+{
+  switch(format)
+  {
+    case GHCN_FORMAT_V3:
+      return "v3";
+    case GHCN_FORMAT_V4:
+      return "v4";
+    case GHCN_FORMAT_DAILY:
+      return "daily";
+    default:
+      return "v2";
+  }
+}
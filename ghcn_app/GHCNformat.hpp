@@ -0,0 +1,125 @@
+#ifndef GHCNFORMAT_HPP
+#define GHCNFORMAT_HPP
+
+#include <stddef.h>
+
+#include "GHCNio.hpp"
+
+//
+// Data-line layouts of the GHCN-Monthly formats.  Each layout is a set
+// of compile-time constants plus a station-ID parser, so the line
+// parser (GHCN::ParseLines) is compiled once per format with all the
+// column arithmetic folded away.
+//
+//   v2:  12-digit ID (country, WMO number, modifier, duplicate), year,
+//        then 12 5-character values in tenths of a degree.
+//
+//   v3, v4:  11-character ID, year, 4-letter element (TAVG, TMAX...),
+//        then 12 8-character fields:  a 5-character value in
+//        hundredths of a degree, then the DMFLAG, QCFLAG and DSFLAG
+//        characters.  v3 IDs are all digits (the v2 ID without the
+//        duplicate digit);  v4 IDs start with a FIPS country code.
+//
+//   GHCN-Daily (.dly):  11-character ID, year, month, 4-letter element
+//        (TMAX, TMIN, TAVG, PRCP...), then 31 8-character day fields:
+//        a 5-character value (tenths of a degree for temperatures),
+//        then the MFLAG, QFLAG and SFLAG characters.  These lines are
+//        averaged into monthly values as they're parsed.
+//
+
+enum GHCN_FORMAT { GHCN_FORMAT_V2, GHCN_FORMAT_V3, GHCN_FORMAT_V4,
+                   GHCN_FORMAT_DAILY };
+
+struct GHCNLayoutV2
+{
+  static const int YEAR_COL=12;
+  static const int TEMPS_COL=16;
+  static const int VALUE_WIDTH=5;
+  static const int FIELD_WIDTH=5;
+  static const int QCFLAG_OFFSET=-1;   // no flags
+  static const int LINE_LEN=TEMPS_COL+12*FIELD_WIDTH;
+  static const int UNITS_PER_DEGREE=10;
+
+  // Blanks in the ID are read as zeros, as they always have been.
+  static bool ParseStation(const char *line, GHCNStationKey& key)
+  {
+    int cc, ss, mod, dup;
+    if(!GHCNParseFixedInt(line, 3, cc) || !GHCNParseFixedInt(line+3, 5, ss))
+    {
+      return false;
+    }
+    if(!GHCNParseFixedInt(line+8, 3, mod))
+    {
+      mod=0;
+    }
+    if(!GHCNParseFixedInt(line+11, 1, dup))
+    {
+      dup=0;
+    }
+    key=GHCNPackStationKey(cc, ss, mod, dup);
+    return true;
+  }
+};
+
+struct GHCNLayoutV3
+{
+  static const int YEAR_COL=11;
+  static const int ELEMENT_COL=15;
+  static const int TEMPS_COL=19;
+  static const int VALUE_WIDTH=5;
+  static const int FIELD_WIDTH=8;
+  static const int QCFLAG_OFFSET=6;
+  static const int LINE_LEN=TEMPS_COL+12*FIELD_WIDTH;
+  static const int UNITS_PER_DEGREE=100;
+
+  static bool ParseStation(const char *line, GHCNStationKey& key)
+  {
+    int cc, ss, mod;
+    if(!GHCNParseFixedInt(line, 3, cc)
+       || !GHCNParseFixedInt(line+3, 5, ss)
+       || !GHCNParseFixedInt(line+8, 3, mod))
+    {
+      return false;
+    }
+    key=GHCNPackStationKey(cc, ss, mod, 0);
+    return true;
+  }
+};
+
+struct GHCNLayoutV4 : public GHCNLayoutV3
+{
+  static bool ParseStation(const char *line, GHCNStationKey& key)
+  {
+    return GHCNParseStationId11(line, key);
+  }
+};
+
+struct GHCNLayoutDaily
+{
+  static const int YEAR_COL=11;
+  static const int MONTH_COL=15;
+  static const int ELEMENT_COL=17;
+  static const int DAYS_COL=21;
+  static const int VALUE_WIDTH=5;
+  static const int FIELD_WIDTH=8;
+  static const int QCFLAG_OFFSET=6;
+  static const int NUM_DAYS=31;
+  static const int LINE_LEN=DAYS_COL+NUM_DAYS*FIELD_WIDTH;
+  static const int UNITS_PER_DEGREE=10;
+
+  // (The station and year, which all of a station-year's lines share.)
+  static const int STATION_YEAR_LEN=MONTH_COL;
+
+  static bool ParseStation(const char *line, GHCNStationKey& key)
+  {
+    return GHCNParseStationId11(line, key);
+  }
+};
+
+// Work out the format of a data file from its first non-blank line.
+// Anything that isn't recognisably v3, v4 or daily is taken to be v2.
+GHCN_FORMAT GHCNDetectFormat(const char *data, size_t size);
+
+const char* GHCNFormatName(GHCN_FORMAT format);
+
+#endif // GHCNFORMAT_HPP
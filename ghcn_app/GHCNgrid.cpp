@@ -0,0 +1,84 @@
+#include "GHCNgrid.hpp"
+
+#include <math.h>
+#include <algorithm>
+
+static const double DEG_TO_RAD=3.14159265358979323846/180.0;
+
+
+GHCNGrid::GHCNGrid(GRID_TYPE type, double cellDegrees)
+{
+  mType=type;
+  mCellDegrees=std::max(0.1, std::min(90.0, cellDegrees));
+
+  int nbands=(int)ceil(180.0/mCellDegrees-1e-9);
+  mBandEdge.resize(nbands+1);
+  mBandFirstCell.resize(nbands+1);
+
+  for(int ib=0; ib<=nbands; ib++)
+  {
+    if(mType==GRID_EQUAL_AREA)
+    {
+      mBandEdge[ib]=asin(-1.0+2.0*ib/nbands)/DEG_TO_RAD;
+    }
+    else
+    {
+      mBandEdge[ib]=std::min(90.0, -90.0+ib*mCellDegrees);
+    }
+  }
+
+  int lonCells=(int)ceil(360.0/mCellDegrees-1e-9);
+  for(int ib=0; ib<nbands; ib++)
+  {
+    double south=mBandEdge[ib]*DEG_TO_RAD;
+    double north=mBandEdge[ib+1]*DEG_TO_RAD;
+    int ncells;
+    double weight;
+
+    if(mType==GRID_EQUAL_AREA)
+    {
+      // Fewer cells towards the poles;  weight = area on the unit
+      // sphere relative to a cellDegrees-square equatorial cell.
+      ncells=std::max(1, (int)floor(lonCells*cos(0.5*(south+north))+0.5));
+      weight=(sin(north)-sin(south))*(360.0*DEG_TO_RAD/ncells)
+	/((mCellDegrees*DEG_TO_RAD)*(mCellDegrees*DEG_TO_RAD));
+    }
+    else
+    {
+      ncells=lonCells;
+      weight=cos(0.5*(south+north));
+    }
+
+    mBandFirstCell[ib]=(int)mWeight.size();
+    mWeight.insert(mWeight.end(), ncells, weight);
+  }
+  mBandFirstCell[nbands]=(int)mWeight.size();
+}
+
+int GHCNGrid::Cell(double lat, double lon) const
+{
+  int nbands=NumBands();
+  int ib;
+
+  if(mType==GRID_EQUAL_AREA)
+  {
+    ib=(int)floor((sin(lat*DEG_TO_RAD)+1.0)*0.5*nbands);
+  }
+  else
+  {
+    ib=(int)floor((lat+90.0)/mCellDegrees);
+  }
+  ib=std::max(0, std::min(nbands-1, ib));
+
+  int ncells=mBandFirstCell[ib+1]-mBandFirstCell[ib];
+  int ic=(int)floor((lon+180.0)/360.0*ncells);
+  ic=std::max(0, std::min(ncells-1, ic));
+
+  return mBandFirstCell[ib]+ic;
+}
+
+int GHCNGrid::Band(int cell) const
+{
+  return (int)(std::upper_bound(mBandFirstCell.begin(), mBandFirstCell.end(),
+                                cell)-mBandFirstCell.begin())-1;
+}
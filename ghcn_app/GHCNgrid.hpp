@@ -0,0 +1,58 @@
+#ifndef GHCNGRID_HPP
+#define GHCNGRID_HPP
+
+#include <vector>
+
+//
+// A global grid of cells for area-weighted averaging.  The globe is cut
+// into latitude bands, and each band into equal-width longitude cells.
+//
+//   GRID_LATLON:      bands and cells cellDegrees on a side;  a cell's
+//                     weight is the cosine of its centre latitude.
+//   GRID_EQUAL_AREA:  bands of equal area (equal steps in sin(latitude)),
+//                     with fewer cells towards the poles so every cell
+//                     is close to cellDegrees x cellDegrees at the 
+//                     equator;  a cell's weight is its exact area.
+//
+// Weights are relative (the equator's latlon cell weighs 1).
+//
+class GHCNGrid
+{
+ public:
+
+  enum GRID_TYPE { GRID_LATLON, GRID_EQUAL_AREA };
+
+  GHCNGrid(GRID_TYPE type, double cellDegrees);
+
+  GRID_TYPE Type(void) const { return mType; }
+  double CellDegrees(void) const { return mCellDegrees; }
+
+  int   NumCells(void) const { return (int)mWeight.size(); }
+
+  // Cell holding a location (degrees north, degrees east).
+  int   Cell(double lat, double lon) const;
+
+  double Weight(int cell) const { return mWeight[cell]; }
+
+  // Latitude band of a cell, and its latitude bounds (degrees).
+  int   Band(int cell) const;
+  double BandSouth(int band) const { return mBandEdge[band]; }
+  double BandNorth(int band) const { return mBandEdge[band+1]; }
+  int   NumBands(void) const { return (int)mBandFirstCell.size()-1; }
+
+  // Cells [BandFirstCell(band), BandFirstCell(band+1)) cover the band
+  // from 180W eastwards.
+  int   BandFirstCell(int band) const { return mBandFirstCell[band]; }
+
+ protected:
+
+  GRID_TYPE mType;
+  double mCellDegrees;
+
+  std::vector<double> mBandEdge;       // NumBands()+1 latitudes, south first
+  std::vector<int>    mBandFirstCell;  // NumBands()+1 entries
+  std::vector<double> mWeight;         // one per cell
+
+};
+
+#endif // GHCNGRID_HPP
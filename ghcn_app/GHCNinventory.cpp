@@ -0,0 +1,214 @@
+#include "GHCNinventory.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+
+// Parse a fixed-width decimal field (blanks around it allowed).
+static bool ParseDecimalField(const char *field, int width, double& value)
+{
+  char buf[32];
+  if(width<=0 || width>=(int)sizeof(buf))
+  {
+    return false;
+  }
+  memcpy(buf, field, width);
+  buf[width]='\0';
+
+  char *end;
+  value=strtod(buf, &end);
+  if(end==buf)
+  {
+    return false;
+  }
+  while(*end==' ')
+  {
+    end++;
+  }
+  return *end=='\0';
+}
+
+GHCNInventory::GHCNInventory()
+{
+  mNumSkipped=0;
+}
+
+bool GHCNInventory::Load(const char *fileName)
+{
+  GHCNMappedFile file;
+  if(!file.Open(fileName))
+  {
+    return false;
+  }
+
+  const char *end=file.Data()+file.Size();
+  const char *eol;
+  for(const char *line=file.Data(); line<end; line=eol+1)
+  {
+    eol=(const char*)memchr(line, '\n', end-line);
+    if(eol==NULL)
+    {
+      eol=end;
+    }
+
+    int len=(int)(eol-line);
+    if(len>0 && line[len-1]=='\r')
+    {
+      len--;
+    }
+    if(len>0 && !ParseLine(line, len))
+    {
+      mNumSkipped++;
+    }
+  }
+
+  BuildBuckets();
+  return true;
+}
+
+int GHCNInventory::LatBucket(double lat)
+{
+  int ib=(int)floor((lat+90.0)/BUCKET_DEGREES);
+  return std::max(0, std::min(LAT_BUCKETS-1, ib));
+}
+
+int GHCNInventory::LonBucket(double lon)
+{
+  int ib=(int)floor((lon+180.0)/BUCKET_DEGREES);
+  return std::max(0, std::min(LON_BUCKETS-1, ib));
+}
+
+void GHCNInventory::BuildBuckets(void)
+{
+  int nbuckets=LAT_BUCKETS*LON_BUCKETS;
+  std::vector<int> bucket(mStations.size());
+
+  // Counting sort of the stations by bucket.
+  mBucketStart.assign(nbuckets+1, 0);
+  for(size_t is=0; is<mStations.size(); is++)
+  {
+    bucket[is]=LatBucket(mStations[is].lat)*LON_BUCKETS
+      + LonBucket(mStations[is].lon);
+    mBucketStart[bucket[is]+1]++;
+  }
+  for(int ib=0; ib<nbuckets; ib++)
+  {
+    mBucketStart[ib+1]+=mBucketStart[ib];
+  }
+
+  std::vector<int> cursor(mBucketStart.begin(), mBucketStart.end()-1);
+  mBucketStations.resize(mStations.size());
+  for(size_t is=0; is<mStations.size(); is++)
+  {
+    mBucketStations[cursor[bucket[is]]++]=(int)is;
+  }
+}
+
+void GHCNInventory::FindInRegion(const GHCNRegion& region, 
+                                 std::vector<GHCNStationKey>& stations) const
+{
+  stations.clear();
+  if(mBucketStart.empty() || region.lat0>region.lat1)
+  {
+    return;
+  }
+
+  // Longitude bucket ranges to look in:  one, or two if the box wraps.
+  int lon0=LonBucket(region.lon0);
+  int lon1=LonBucket(region.lon1);
+  int ranges[2][2]={ { lon0, lon1 }, { 0, -1 } };
+  if(region.lon0>region.lon1)
+  {
+    ranges[0][1]=LON_BUCKETS-1;
+    ranges[1][0]=0;
+    ranges[1][1]=lon1;
+  }
+
+  for(int ilat=LatBucket(region.lat0); ilat<=LatBucket(region.lat1); ilat++)
+  {
+    for(int ir=0; ir<2; ir++)
+    {
+      for(int ilon=ranges[ir][0]; ilon<=ranges[ir][1]; ilon++)
+      {
+	int ib=ilat*LON_BUCKETS+ilon;
+	for(int jj=mBucketStart[ib]; jj<mBucketStart[ib+1]; jj++)
+	{
+	  const Station& st=mStations[mBucketStations[jj]];
+	  if(region.Contains(st.lat, st.lon))
+	  {
+	    stations.push_back(st.key);
+	  }
+	}
+      }
+    }
+  }
+
+  std::sort(stations.begin(), stations.end());
+}
+
+bool GHCNInventory::ParseLine(const char *line, int len)
+{
+  // Columns (0-based) of the latitude and longitude fields.
+  static const int V3_LAT_COL=12, V3_LAT_WIDTH=8;
+  static const int V3_LON_COL=21, V3_LON_WIDTH=9;
+  static const int V2_LAT_COL=43, V2_LAT_WIDTH=6;
+  static const int V2_LON_COL=50, V2_LON_WIDTH=7;
+
+  GHCNStationKey key;
+  double lat, lon;
+
+  if(len<V3_LON_COL+V3_LON_WIDTH || !GHCNParseStationId11(line, key))
+  {
+    return false;
+  }
+
+  // v3 has the latitude straight after the ID;  v2 has the name there.
+  if(!ParseDecimalField(line+V3_LAT_COL, V3_LAT_WIDTH, lat)
+     || !ParseDecimalField(line+V3_LON_COL, V3_LON_WIDTH, lon))
+  {
+    if(len<V2_LON_COL+V2_LON_WIDTH
+       || !ParseDecimalField(line+V2_LAT_COL, V2_LAT_WIDTH, lat)
+       || !ParseDecimalField(line+V2_LON_COL, V2_LON_WIDTH, lon))
+    {
+      return false;
+    }
+  }
+
+  if(lat<-90.0 || lat>90.0 || lon<-180.0 || lon>180.0)
+  {
+    return false;
+  }
+
+  Station st;
+  st.key=key;
+  st.lat=(float)lat;
+  st.lon=(float)lon;
+
+  // A repeated ID replaces the earlier entry.
+  std::unordered_map<GHCNStationKey,int>::iterator it=mIndex.find(st.key);
+  if(it!=mIndex.end())
+  {
+    mStations[it->second]=st;
+  }
+  else
+  {
+    mIndex[st.key]=(int)mStations.size();
+    mStations.push_back(st);
+  }
+  return true;
+}
+
+bool GHCNInventory::Find(GHCNStationKey station, float& lat, float& lon) const
+{
+  std::unordered_map<GHCNStationKey,int>::const_iterator it=
+    mIndex.find(GHCNStationGroup(station));
+  if(it==mIndex.end())
+  {
+    return false;
+  }
+  lat=mStations[it->second].lat;
+  lon=mStations[it->second].lon;
+  return true;
+}
@@ -0,0 +1,94 @@
+#ifndef GHCNINVENTORY_HPP
+#define GHCNINVENTORY_HPP
+
+#include <stddef.h>
+#include <vector>
+#include <unordered_map>
+
+#include "GHCNio.hpp"
+
+
+// A latitude/longitude box, in degrees.  A box with lon0 > lon1 wraps
+// across the 180 degree meridian.
+struct GHCNRegion
+{
+  double lat0, lat1;
+  double lon0, lon1;
+
+  bool  Contains(double lat, double lon) const
+  {
+    if(lat<lat0 || lat>lat1)
+    {
+      return false;
+    }
+    return (lon0<=lon1) ? (lon>=lon0 && lon<=lon1) 
+                        : (lon>=lon0 || lon<=lon1);
+  }
+};
+
+
+//
+// Station locations from a GHCN station inventory file.  Both the v2
+// layout (v2.temperature.inv:  ID, 30-character name, latitude,
+// longitude...) and the v3/v4 layout (ID, latitude, longitude, 
+// elevation, name...) are read;  which one a line is in is worked out
+// line by line.  v4's alphanumeric IDs are keyed the way the v4 data
+// reader keys them (see GHCNParseStationId11()).
+//
+// The stations are also bucketed on a coarse lat/lon grid, so that 
+// the stations in a region can be found without looking at them all.
+//
+class GHCNInventory
+{
+ public:
+
+  GHCNInventory();
+
+  // Returns false if the file can't be read.  Lines that don't parse
+  // are skipped (and counted).
+  bool  Load(const char *fileName);
+
+  // Location of a station.  Inventory IDs have no duplicate digit, so
+  // every duplicate series of a station gets the same location.
+  bool  Find(GHCNStationKey station, float& lat, float& lon) const;
+
+  // Keys (duplicate digit 0) of the stations inside region, in key 
+  // order.
+  void  FindInRegion(const GHCNRegion& region, 
+                     std::vector<GHCNStationKey>& stations) const;
+
+  size_t NumStations(void) const { return mStations.size(); }
+  size_t NumSkipped(void) const { return mNumSkipped; }
+
+ protected:
+
+  struct Station
+  {
+    GHCNStationKey key;   // GHCNStationGroup() of the station key
+    float lat;
+    float lon;
+  };
+
+  std::vector<Station> mStations;
+  std::unordered_map<GHCNStationKey,int> mIndex;
+
+  // Bucket (ilat,ilon) of BUCKET_DEGREES on a side holds the stations
+  // mBucketStations[mBucketStart[ib] .. mBucketStart[ib+1]), where
+  // ib = ilat*LON_BUCKETS+ilon.
+  static const int BUCKET_DEGREES=2;
+  static const int LAT_BUCKETS=180/BUCKET_DEGREES;
+  static const int LON_BUCKETS=360/BUCKET_DEGREES;
+  std::vector<int> mBucketStart;
+  std::vector<int> mBucketStations;
+
+  size_t mNumSkipped;
+
+  bool  ParseLine(const char *line, int len);
+  void  BuildBuckets(void);
+
+  static int LatBucket(double lat);
+  static int LonBucket(double lon);
+
+};
+
+#endif // GHCNINVENTORY_HPP
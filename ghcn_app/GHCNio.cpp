@@ -0,0 +1,642 @@
+#include "GHCNio.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
+
+
+GHCNMappedFile::GHCNMappedFile()
+{
+  mbIsOpen=false;
+  mbIsMapped=false;
+  mData=NULL;
+  mSize=0;
+  mHeapData=NULL;
+#if defined(_WIN32)
+  mFileHandle=NULL;
+  mMapHandle=NULL;
+#endif
+}
+
+GHCNMappedFile::~GHCNMappedFile()
+{
+  Close();
+}
+
+bool GHCNMappedFile::Open(const char *fileName)
+{
+  Close();
+
+#if defined(_WIN32)
+
+  HANDLE hFile = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if(hFile==INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+
+  LARGE_INTEGER fileSize;
+  if(GetFileType(hFile)!=FILE_TYPE_DISK || !GetFileSizeEx(hFile,&fileSize))
+  {
+    CloseHandle(hFile);
+    return ReadAll(fileName);
+  }
+
+  mFileHandle=hFile;
+  mSize=(size_t)fileSize.QuadPart;
+  if(mSize>0)
+  {
+    mMapHandle=CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mMapHandle!=NULL)
+    {
+      mData=(const char*)MapViewOfFile(mMapHandle, FILE_MAP_READ, 0, 0, 0);
+    }
+    if(mData==NULL)
+    {
+      Close();
+      return ReadAll(fileName);
+    }
+    mbIsMapped=true;
+  }
+
+#else
+
+  int fd=open(fileName, O_RDONLY);
+  if(fd<0)
+  {
+    return false;
+  }
+
+  struct stat st;
+  if(fstat(fd,&st)!=0 || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return ReadAll(fileName);
+  }
+
+  mSize=(size_t)st.st_size;
+  if(mSize>0)
+  {
+    void *addr=mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(addr==MAP_FAILED)
+    {
+      close(fd);
+      mSize=0;
+      return ReadAll(fileName);
+    }
+#if defined(MADV_SEQUENTIAL)
+    madvise(addr, mSize, MADV_SEQUENTIAL);
+#endif
+    mData=(const char*)addr;
+    mbIsMapped=true;
+  }
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+
+#endif
+
+  mbIsOpen=true;
+  return true;
+}
+
+void GHCNMappedFile::DropPages(size_t nbytes)
+{
+#if !defined(_WIN32) && defined(MADV_DONTNEED)
+  if(mbIsMapped)
+  {
+    size_t pageSize=(size_t)sysconf(_SC_PAGESIZE);
+    nbytes=(nbytes<mSize ? nbytes : mSize)/pageSize*pageSize;
+    if(nbytes>0)
+    {
+      madvise((void*)mData, nbytes, MADV_DONTNEED);
+    }
+  }
+#else
+  (void)nbytes;
+#endif
+}
+
+// Fallback for inputs that can't be mapped:  slurp the whole thing.
+bool GHCNMappedFile::ReadAll(const char *fileName)
+{
+  FILE *fp=fopen(fileName,"rb");
+  if(fp==NULL)
+  {
+    return false;
+  }
+
+  size_t capacity=1<<20;
+  size_t nread;
+  mHeapData=(char*)malloc(capacity);
+  mSize=0;
+  while(mHeapData!=NULL 
+        && (nread=fread(mHeapData+mSize, 1, capacity-mSize, fp))>0)
+  {
+    mSize+=nread;
+    if(mSize==capacity)
+    {
+      capacity*=2;
+      char *grown=(char*)realloc(mHeapData,capacity);
+      if(grown==NULL)
+      {
+        free(mHeapData);
+      }
+      mHeapData=grown;
+    }
+  }
+  fclose(fp);
+
+  if(mHeapData==NULL)
+  {
+    mSize=0;
+    return false;
+  }
+
+  mData=mHeapData;
+  mbIsOpen=true;
+  return true;
+}
+
+void GHCNMappedFile::Close(void)
+{
+#if defined(_WIN32)
+  if(mbIsMapped)
+  {
+    UnmapViewOfFile((LPCVOID)mData);
+  }
+  if(mMapHandle!=NULL)
+  {
+    CloseHandle((HANDLE)mMapHandle);
+  }
+  if(mFileHandle!=NULL)
+  {
+    CloseHandle((HANDLE)mFileHandle);
+  }
+  mFileHandle=NULL;
+  mMapHandle=NULL;
+#else
+  if(mbIsMapped)
+  {
+    munmap((void*)mData, mSize);
+  }
+#endif
+
+  free(mHeapData);
+  mHeapData=NULL;
+
+  mbIsOpen=false;
+  mbIsMapped=false;
+  mData=NULL;
+  mSize=0;
+}
+
+bool GHCNParseCountryList(const std::string& text, 
+                          std::vector<GHCNStationKey>& countries)
+{
+  countries.clear();
+
+  size_t start=0;
+  while(start<=text.size())
+  {
+    size_t comma=text.find(',', start);
+    std::string code=text.substr(start, (comma==std::string::npos) 
+                                 ? std::string::npos : comma-start);
+    start = (comma==std::string::npos) ? text.size()+1 : comma+1;
+
+    bool digits=!code.empty() && code.size()<=3;
+    for(size_t ii=0; ii<code.size(); ii++)
+    {
+      digits = digits && (unsigned)(code[ii]-'0')<=9;
+    }
+
+    if(digits)
+    {
+      countries.push_back(GHCNPackStationKey(atoi(code.c_str()), 0, 0, 0));
+    }
+    else if(code.size()==2 && isalpha((unsigned char)code[0]) 
+            && isalpha((unsigned char)code[1]))
+    {
+      // A v4 ID starting with these two letters and then all zeros.
+      char id[12]="00000000000";
+      id[0]=(char)toupper((unsigned char)code[0]);
+      id[1]=(char)toupper((unsigned char)code[1]);
+      GHCNStationKey key;
+      GHCNParseStationId11(id, key);
+      countries.push_back(key);
+    }
+    else
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+FILE* GHCNOpenStream(const char *fileName)
+{
+  if(strcmp(fileName, "-")==0)
+  {
+#if defined(_WIN32)
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    return stdin;
+  }
+
+#if defined(_WIN32)
+
+  // (Named pipes opened by name are read whole by GHCNMappedFile.)
+  return NULL;
+
+#else
+
+  struct stat st;
+  if(stat(fileName, &st)!=0 
+     || !(S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode) || S_ISSOCK(st.st_mode)))
+  {
+    return NULL;
+  }
+  return fopen(fileName, "rb");
+
+#endif
+}
+
+bool GHCNListDirectory(const char *dirName, const char *suffix,
+                       std::vector<std::string>& fileNames)
+{
+  std::string dir(dirName);
+  fileNames.clear();
+
+#if defined(_WIN32)
+
+  DWORD attrs=GetFileAttributesA(dirName);
+  if(attrs==INVALID_FILE_ATTRIBUTES || !(attrs & FILE_ATTRIBUTE_DIRECTORY))
+  {
+    return false;
+  }
+
+  WIN32_FIND_DATAA found;
+  HANDLE hFind=FindFirstFileA((dir+"\\*"+suffix).c_str(), &found);
+  if(hFind!=INVALID_HANDLE_VALUE)
+  {
+    do
+    {
+      if(!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+      {
+	fileNames.push_back(dir+"\\"+found.cFileName);
+      }
+    } while(FindNextFileA(hFind, &found));
+    FindClose(hFind);
+  }
+
+#else
+
+  DIR *dp=opendir(dirName);
+  if(dp==NULL)
+  {
+    return false;
+  }
+
+  size_t nsuffix=strlen(suffix);
+  struct dirent *ent;
+  while((ent=readdir(dp))!=NULL)
+  {
+    size_t len=strlen(ent->d_name);
+    if(len>nsuffix && strcmp(ent->d_name+len-nsuffix, suffix)==0)
+    {
+      fileNames.push_back(dir+"/"+ent->d_name);
+    }
+  }
+  closedir(dp);
+
+#endif
+
+  std::sort(fileNames.begin(), fileNames.end());
+  return true;
+}
+
+uint64_t GHCNHash64(const void *data, size_t size, uint64_t seed)
+{
+  const uint64_t mm=0xc6a4a7935bd1e995ULL;
+  const int rr=47;
+  const unsigned char *pp=(const unsigned char*)data;
+  const unsigned char *end=pp+(size&~(size_t)7);
+  uint64_t hh=seed^(size*mm);
+
+  for(; pp<end; pp+=8)
+  {
+    uint64_t kk;
+    memcpy(&kk,pp,8);
+    kk*=mm;
+    kk^=kk>>rr;
+    kk*=mm;
+    hh^=kk;
+    hh*=mm;
+  }
+
+  // Leftover 1-7 bytes.
+  if((size&7)!=0)
+  {
+    for(int ii=(int)(size&7)-1; ii>=0; ii--)
+    {
+      hh^=(uint64_t)pp[ii]<<(8*ii);
+    }
+    hh*=mm;
+  }
+
+  hh^=hh>>rr;
+  hh*=mm;
+  hh^=hh>>rr;
+  return hh;
+}
+
+
+
+//
+// Twelve-field temperature parse kernels.
+//
+// Each kernel loads a field pair (10 bytes) into a pair of 8-byte lanes,
+// right-aligned so that lane bytes 3..7 hold field chars 0..4.  Digits
+// are turned into values with the usual multiply-add ladder
+// (x10 pairs -> x100 pairs -> x10000 pairs), and per-byte digit, minus
+// and space masks are used to check the field layout and pick up the
+// sign.
+//
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GHCN_X86_SIMD 1
+#endif
+
+#if defined(GHCN_X86_SIMD)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define GHCN_TARGET(isa)
+#else
+#define GHCN_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+typedef bool (*GHCNParseTemps12Fn)(const char *temps, int *tt);
+
+static bool ParseTemps12Scalar(const char *temps, int *tt)
+{
+  bool ok=true;
+  for(int ii=0; ii<12; ii++)
+  {
+    ok = GHCNParseFixedInt(temps+5*ii, 5, tt[ii]) && ok;
+  }
+  return ok;
+}
+
+#if defined(GHCN_X86_SIMD)
+
+// Check the layout of nfields fields from their per-byte digit, minus
+// and space masks (8 mask bits per field, field chars in bits 3..7),
+// i.e. blanks, then an optional '-', then digits up to the end of the
+// field.  Sets bit k of neg for each negative field.
+static inline bool CheckFieldMasks(unsigned digits, unsigned minus, 
+                                   unsigned space, int nfields, int& neg)
+{
+  neg=0;
+  for(int kk=0; kk<nfields; kk++)
+  {
+    unsigned d5=(digits>>(8*kk+3))&0x1F;
+    unsigned m5=(minus>>(8*kk+3))&0x1F;
+    unsigned s5=(space>>(8*kk+3))&0x1F;
+    unsigned low=d5&(0u-d5);  // leftmost digit
+
+    // Digits must be one run ending at the last char of the field,
+    // a '-' may only sit just before it, and everything before that
+    // must be blank.
+    if(d5+low!=0x20 || (m5!=0 && m5!=(low>>1)))
+    {
+      return false;
+    }
+    if(s5!=(m5!=0 ? m5 : low)-1)
+    {
+      return false;
+    }
+    neg|=(m5!=0)<<kk;
+  }
+  return true;
+}
+
+static inline void ApplySigns(int *tt, int neg)
+{
+  for(int ii=0; ii<12; ii++)
+  {
+    int nn=-((neg>>ii)&1);
+    tt[ii]=(tt[ii]^nn)-nn;
+  }
+}
+
+GHCN_TARGET("ssse3")
+static bool ParseTemps12SSSE3(const char *temps, int *tt)
+{
+  const __m128i ch0=_mm_set1_epi8('0');
+  const __m128i nine=_mm_set1_epi8(9);
+  const __m128i minus=_mm_set1_epi8('-');
+  const __m128i space=_mm_set1_epi8(' ');
+  const __m128i w10=_mm_setr_epi8(10,1,10,1,10,1,10,1,10,1,10,1,10,1,10,1);
+  const __m128i w100=_mm_setr_epi16(100,1,100,1,100,1,100,1);
+  const __m128i w10000=_mm_setr_epi16(10000,1,10000,1,10000,1,10000,1);
+  // Field pair at the start of the 16 loaded bytes...
+  const __m128i pick0=_mm_setr_epi8(-128,-128,-128,0,1,2,3,4,
+                                    -128,-128,-128,5,6,7,8,9);
+  // ...or 6 bytes in (the last pair, loaded from byte 44 so that the
+  // load stays inside the 60-byte window).
+  const __m128i pick6=_mm_setr_epi8(-128,-128,-128,6,7,8,9,10,
+                                    -128,-128,-128,11,12,13,14,15);
+  __m128i pairs[6];
+  int neg=0;
+
+  for(int ip=0; ip<6; ip++)
+  {
+    __m128i raw, ch, dd, isdig;
+    int pneg;
+
+    if(ip<5)
+    {
+      raw=_mm_loadu_si128((const __m128i*)(temps+10*ip));
+      ch=_mm_shuffle_epi8(raw,pick0);
+    }
+    else
+    {
+      raw=_mm_loadu_si128((const __m128i*)(temps+44));
+      ch=_mm_shuffle_epi8(raw,pick6);
+    }
+
+    dd=_mm_sub_epi8(ch,ch0);
+    isdig=_mm_cmpeq_epi8(_mm_min_epu8(dd,nine),dd);
+
+    if(!CheckFieldMasks(_mm_movemask_epi8(isdig),
+                        _mm_movemask_epi8(_mm_cmpeq_epi8(ch,minus)),
+                        _mm_movemask_epi8(_mm_cmpeq_epi8(ch,space)),
+                        2, pneg))
+    {
+      return false;
+    }
+    neg|=pneg<<(2*ip);
+
+    dd=_mm_and_si128(dd,isdig);
+    pairs[ip]=_mm_madd_epi16(_mm_maddubs_epi16(dd,w10),w100);
+  }
+
+  for(int ip=0; ip<6; ip+=2)
+  {
+    __m128i vv=_mm_madd_epi16(_mm_packs_epi32(pairs[ip],pairs[ip+1]),w10000);
+    _mm_storeu_si128((__m128i*)(tt+2*ip),vv);
+  }
+
+  ApplySigns(tt,neg);
+  return true;
+}
+
+GHCN_TARGET("avx2")
+static bool ParseTemps12AVX2(const char *temps, int *tt)
+{
+  const __m256i ch0=_mm256_set1_epi8('0');
+  const __m256i nine=_mm256_set1_epi8(9);
+  const __m256i minus=_mm256_set1_epi8('-');
+  const __m256i space=_mm256_set1_epi8(' ');
+  const __m256i w10=_mm256_set1_epi16(0x010A);  // bytes 10,1,10,1...
+  const __m256i w100=_mm256_set1_epi32(0x00010064);  // words 100,1,...
+  const __m256i w10000=_mm256_set1_epi32(0x00012710);  // words 10000,1,...
+  // Same lane layout as the SSSE3 kernel, one field pair per 128-bit
+  // half.  The last pair is loaded from byte 44 and picked 6 bytes in.
+  const __m256i pick00=_mm256_setr_epi8(-128,-128,-128,0,1,2,3,4,
+                                        -128,-128,-128,5,6,7,8,9,
+                                        -128,-128,-128,0,1,2,3,4,
+                                        -128,-128,-128,5,6,7,8,9);
+  const __m256i pick06=_mm256_setr_epi8(-128,-128,-128,0,1,2,3,4,
+                                        -128,-128,-128,5,6,7,8,9,
+                                        -128,-128,-128,6,7,8,9,10,
+                                        -128,-128,-128,11,12,13,14,15);
+  __m256i quads[3];
+  int neg=0;
+
+  for(int iq=0; iq<3; iq++)
+  {
+    __m128i lo=_mm_loadu_si128((const __m128i*)(temps+20*iq));
+    __m128i hi=_mm_loadu_si128((const __m128i*)(temps+(iq<2 ? 20*iq+10 : 44)));
+    __m256i raw=_mm256_inserti128_si256(_mm256_castsi128_si256(lo),hi,1);
+    __m256i ch=_mm256_shuffle_epi8(raw, iq<2 ? pick00 : pick06);
+    __m256i dd=_mm256_sub_epi8(ch,ch0);
+    __m256i isdig=_mm256_cmpeq_epi8(_mm256_min_epu8(dd,nine),dd);
+    int qneg;
+
+    if(!CheckFieldMasks((unsigned)_mm256_movemask_epi8(isdig),
+                        (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(ch,minus)),
+                        (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(ch,space)),
+                        4, qneg))
+    {
+      return false;
+    }
+    neg|=qneg<<(4*iq);
+
+    dd=_mm256_and_si256(dd,isdig);
+    quads[iq]=_mm256_madd_epi16(_mm256_maddubs_epi16(dd,w10),w100);
+  }
+
+  // packs works within 128-bit halves, so the fields come out as
+  // 0,1,4,5 | 2,3,6,7 and need their 64-bit chunks put back in order.
+  __m256i vv=_mm256_madd_epi16(_mm256_packs_epi32(quads[0],quads[1]),w10000);
+  _mm256_storeu_si256((__m256i*)tt,_mm256_permute4x64_epi64(vv,0xD8));
+  vv=_mm256_madd_epi16(_mm256_packs_epi32(quads[2],quads[2]),w10000);
+  vv=_mm256_permute4x64_epi64(vv,0xD8);
+  _mm_storeu_si128((__m128i*)(tt+8),_mm256_castsi256_si128(vv));
+
+  ApplySigns(tt,neg);
+  return true;
+}
+
+static bool CpuHasSSSE3(void)
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info,1);
+  return (info[2] & (1<<9))!=0;
+#else
+  return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+static bool CpuHasAVX2(void)
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info,0);
+  if(info[0]<7)
+  {
+    return false;
+  }
+  __cpuid(info,1);
+  // Need OSXSAVE and AVX, and the OS has to save the ymm state.
+  if((info[2] & (1<<27))==0 || (info[2] & (1<<28))==0
+     || (_xgetbv(0) & 6)!=6)
+  {
+    return false;
+  }
+  __cpuidex(info,7,0);
+  return (info[1] & (1<<5))!=0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // GHCN_X86_SIMD
+
+static const char *gParseTemps12Name="scalar";
+
+static GHCNParseTemps12Fn SelectParseTemps12(void)
+{
+  const char *force=getenv("GHCN_SIMD");
+
+#if defined(GHCN_X86_SIMD)
+  if((force==NULL || strcmp(force,"avx2")==0) && CpuHasAVX2())
+  {
+    gParseTemps12Name="avx2";
+    return ParseTemps12AVX2;
+  }
+  if((force==NULL || strcmp(force,"avx2")==0 || strcmp(force,"ssse3")==0)
+     && CpuHasSSSE3())
+  {
+    gParseTemps12Name="ssse3";
+    return ParseTemps12SSSE3;
+  }
+#else
+  (void)force;
+#endif
+
+  gParseTemps12Name="scalar";
+  return ParseTemps12Scalar;
+}
+
+static GHCNParseTemps12Fn gParseTemps12=SelectParseTemps12();
+
+bool GHCNParseTemps12(const char *temps, int *tt)
+{
+  return gParseTemps12(temps,tt);
+}
+
+const char* GHCNParseTemps12Kernel(void)
+{
+  return gParseTemps12Name;
+}
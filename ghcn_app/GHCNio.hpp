@@ -0,0 +1,243 @@
+#ifndef GHCNIO_HPP
+#define GHCNIO_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+//
+// Input helpers for the GHCN reader:  a read-only memory-mapped view
+// of an input file, stream and directory openers, and a parser for the
+// fixed-width integer fields of the GHCN data lines that works 
+// directly on the mapped bytes.
+//
+
+
+// Read-only view of a whole file.  Regular files are memory-mapped;
+// anything that can't be mapped (pipes, special files) is read into
+// a heap buffer instead, so callers always see one contiguous block.
+class GHCNMappedFile
+{
+ public:
+
+  GHCNMappedFile();
+  virtual ~GHCNMappedFile();
+
+  bool  Open(const char *fileName);
+  void  Close(void);
+
+  bool  IsOpen(void) const { return mbIsOpen; }
+
+  const char* Data(void) const { return mData; }
+  size_t Size(void) const { return mSize; }
+
+  // Done with the first nbytes of the file:  let the OS drop those
+  // pages from our resident set.  (They're read back in if touched.)
+  void  DropPages(size_t nbytes);
+
+ protected:
+
+  bool  ReadAll(const char *fileName);
+
+  bool mbIsOpen;
+  bool mbIsMapped;
+
+  const char *mData;
+  size_t mSize;
+
+  char *mHeapData;  // used when the file can't be mapped
+
+#if defined(_WIN32)
+  void *mFileHandle;
+  void *mMapHandle;
+#endif
+
+ private:
+  GHCNMappedFile(const GHCNMappedFile&);
+  GHCNMappedFile& operator=(const GHCNMappedFile&);
+
+};
+
+
+// Parse a right-justified integer field of the given width, the way
+// sscanf("%<width>d") reads well-formed GHCN fields:  leading blanks,
+// an optional sign, then digits up to the end of the field.
+// Returns false (and leaves value alone) if the field has no digits.
+inline bool GHCNParseFixedInt(const char *field, int width, int& value)
+{
+  const char *pp=field;
+  const char *end=field+width;
+  bool neg=false;
+
+  while(pp<end && *pp==' ')
+  {
+    pp++;
+  }
+  if(pp<end && (*pp=='-' || *pp=='+'))
+  {
+    neg=(*pp=='-');
+    pp++;
+  }
+  if(pp>=end || (unsigned)(*pp-'0')>9)
+  {
+    return false;
+  }
+
+  int vv=0;
+  while(pp<end && (unsigned)(*pp-'0')<=9)
+  {
+    vv=vv*10+(*pp-'0');
+    pp++;
+  }
+
+  value = neg ? -vv : vv;
+  return true;
+}
+
+
+// Full GHCN station ID packed into 64 bits:  3-digit country code,
+// 5-digit WMO station number, 3-digit modifier and 1-digit duplicate
+// number, most significant first, so keys sort the way the IDs do in
+// the data files.  All the duplicates of one station share the key's
+// upper bits (see GHCNStationGroup()).
+typedef uint64_t GHCNStationKey;
+
+inline GHCNStationKey GHCNPackStationKey(int country, int wmo, 
+                                         int modifier, int duplicate)
+{
+  return ((GHCNStationKey)(country&0x3ff)<<31)
+    | ((GHCNStationKey)(wmo&0x1ffff)<<14)
+    | ((GHCNStationKey)(modifier&0x3ff)<<4)
+    | (GHCNStationKey)(duplicate&0xf);
+}
+
+// GHCN v4 station IDs are 11 letters and digits (FIPS country code,
+// network code, station number).  Those are packed as a base-36 number
+// above the 4 duplicate bits, with the top bit set so they never
+// collide with (and sort after) the all-digit keys above.
+static const GHCNStationKey GHCN_ALNUM_STATION_KEY=(GHCNStationKey)1<<63;
+
+inline bool GHCNStationIsAlnum(GHCNStationKey key)
+  { return (key&GHCN_ALNUM_STATION_KEY)!=0; }
+
+// Key for an 11-character v3/v4 station ID (v2 IDs without their
+// duplicate digit look the same).  All-digit IDs get the same key as
+// GHCNPackStationKey(country, wmo, modifier, 0), so v2 and v3 data and
+// inventories mix.  Returns false if the ID has anything but digits and
+// upper-case letters in it.
+inline bool GHCNParseStationId11(const char *id, GHCNStationKey& key)
+{
+  bool digits=true;
+  for(int ii=0; ii<11; ii++)
+  {
+    if((unsigned)(id[ii]-'0')>9)
+    {
+      digits=false;
+      if((unsigned)(id[ii]-'A')>25)
+      {
+	return false;
+      }
+    }
+  }
+
+  if(digits)
+  {
+    int cc=0, ss=0, mod=0;
+    GHCNParseFixedInt(id, 3, cc);
+    GHCNParseFixedInt(id+3, 5, ss);
+    GHCNParseFixedInt(id+8, 3, mod);
+    key=GHCNPackStationKey(cc, ss, mod, 0);
+    return true;
+  }
+
+  GHCNStationKey packed=0;
+  for(int ii=0; ii<11; ii++)
+  {
+    int cc=id[ii];
+    packed=packed*36 + (unsigned)((cc<='9') ? cc-'0' : cc-'A'+10);
+  }
+  key=GHCN_ALNUM_STATION_KEY | (packed<<4);
+  return true;
+}
+
+// The GHCN country code of a station;  -1 for an alphanumeric (v4) 
+// ID, which has a FIPS letter code instead.
+inline int GHCNStationCountry(GHCNStationKey key) 
+  { return GHCNStationIsAlnum(key) ? -1 : (int)(key>>31)&0x3ff; }
+inline int GHCNStationWMO(GHCNStationKey key) 
+  { return (int)(key>>14)&0x1ffff; }
+inline int GHCNStationModifier(GHCNStationKey key) 
+  { return (int)(key>>4)&0x3ff; }
+inline int GHCNStationDuplicate(GHCNStationKey key) 
+  { return (int)key&0xf; }
+
+// The key with the duplicate number cleared:  the same for every
+// duplicate series of a station.
+inline GHCNStationKey GHCNStationGroup(GHCNStationKey key) 
+  { return key&~(GHCNStationKey)0xf; }
+
+// The base-36 weight of a v4 ID's first character after its 2-letter
+// FIPS country code (36^9).
+static const GHCNStationKey GHCN_ALNUM_COUNTRY_UNIT=101559956668416ULL;
+
+// A station's country, as the lowest key any station in it can have:
+// the key with everything after the GHCN country code (all-digit IDs)
+// or the FIPS code (v4 IDs) cleared.  Every station in the country
+// has a key in [country, GHCNNextCountryKey(country)).
+inline GHCNStationKey GHCNCountryKey(GHCNStationKey key)
+{
+  if(GHCNStationIsAlnum(key))
+  {
+    GHCNStationKey packed=(key&~GHCN_ALNUM_STATION_KEY)>>4;
+    return GHCN_ALNUM_STATION_KEY
+      | ((packed-packed%GHCN_ALNUM_COUNTRY_UNIT)<<4);
+  }
+  return GHCNPackStationKey(GHCNStationCountry(key), 0, 0, 0);
+}
+
+inline GHCNStationKey GHCNNextCountryKey(GHCNStationKey country)
+{
+  return GHCNStationIsAlnum(country) ? country+(GHCN_ALNUM_COUNTRY_UNIT<<4)
+    : GHCNPackStationKey(GHCNStationCountry(country)+1, 0, 0, 0);
+}
+
+// Parse a comma-separated list of country codes -- GHCN numbers (1 to
+// 3 digits, as in v2/v3 IDs) or 2-letter FIPS codes (as in v4 IDs) --
+// into GHCNCountryKey()s.  Returns false if any code is neither.
+bool GHCNParseCountryList(const std::string& text, 
+                          std::vector<GHCNStationKey>& countries);
+
+// If fileName is a stream -- "-" for standard input, a pipe or FIFO,
+// a terminal or other character device -- open it for reading (in
+// binary mode).  These can only be read once, front to back, so they
+// are read a block at a time instead of being mapped.  Returns NULL
+// for anything else (regular files, directories, missing files).
+FILE* GHCNOpenStream(const char *fileName);
+
+// The files in a directory whose names end in suffix, as paths
+// (dirName/name), sorted.  Returns false if dirName isn't a directory
+// that can be read.
+bool GHCNListDirectory(const char *dirName, const char *suffix,
+                       std::vector<std::string>& fileNames);
+
+// 64-bit hash of a block of bytes (MurmurHash64A), used to recognise
+// input files that haven't changed since they were last parsed.
+uint64_t GHCNHash64(const void *data, size_t size, uint64_t seed=0);
+
+// Parse the twelve 5-character temperature fields of a v2 data line
+// (the 60 bytes starting at temps) into tt[0..11].  Uses an SSSE3 or
+// AVX2 kernel when the CPU has one, otherwise the scalar parser above.
+// Returns false if any field isn't a plain right-justified integer
+// (blank, '+' sign, junk...);  the caller should then fall back to
+// parsing the fields one at a time.
+bool GHCNParseTemps12(const char *temps, int *tt);
+
+// Name of the kernel GHCNParseTemps12() is using ("avx2", "ssse3" or
+// "scalar").  The choice can be forced by setting the GHCN_SIMD
+// environment variable to one of those names.
+const char* GHCNParseTemps12Kernel(void);
+
+#endif // GHCNIO_HPP
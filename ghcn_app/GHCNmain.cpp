@@ -0,0 +1,903 @@
+// The gcsv program:  option parsing and main().  The analysis itself
+// is in GHCNcsv.cpp, which doesn't depend on anything here.
+
+#include "GHCNcsv.hpp"
+
+#include <string.h>
+#include <sstream>
+#include <mutex>
+
+#include "GHCNparallel.hpp"
+#include "GHCNbench.hpp"
+#include "GHCNstats.hpp"
+#include "GHCNquery.hpp"
+#include "GHCNserver.hpp"
+#include "GHCNoutput.hpp"
+
+// Globals, yuck.  
+int avgNyear_g;
+int minBaselineSampleCount_g;
+int numJobs_g;
+string cacheDir_g;
+bool streaming_g;
+string statsFile_g;
+GHCN::DUPLICATE_MODE duplicateMode_g;
+string loadState_g;
+string saveState_g;
+string inventoryFile_g;
+bool gridded_g;
+GHCNGrid::GRID_TYPE gridType_g;
+double cellDegrees_g;
+vector<GHCNStationKey> countries_g;
+bool hasRegion_g;
+GHCNRegion region_g;
+GHCNInventory *inventory_g;
+GHCNGrid *grid_g;
+int firstBaselineYear_g;
+int lastBaselineYear_g;
+string queryFile_g;
+vector<GHCNQuery> queries_g;
+string serveSocket_g;
+string arrowPrefix_g;
+bool dropQcFlagged_g;
+GHCN::DAILY_ELEMENT dailyElement_g;
+int minDaysPerMonth_g;
+
+
+void PrintUsage(const char *prog)
+{
+  cerr << endl 
+       << "Usage: " << prog  << endl
+       << "         [-A (int)smoothing-filter-length-years] \\ " << endl
+       << "         [-B (int)min-baseline-sample-count] \\ "     << endl
+       << "         [-j (int)parallel-jobs (0 = all cores)] \\ " << endl
+       << "         [-c (char*)parsed-data-cache-directory] \\ " << endl
+       << "         [-S (stream sorted input in one pass)] \\ " << endl
+       << "         [--baseline (int)first-year-(int)last-year] \\ " << endl
+       << "         [--stats (char*)json-file ('-' = stderr)] \\ " << endl
+       << "         [--duplicates separate|combine] \\ " << endl
+       << "         [--qc-flagged drop|keep  (v3/v4/daily values)] \\ " << endl
+       << "         [--daily-element TAVG|TMAX|TMIN] "
+       << "[--min-days (int)days-per-month] \\ " << endl
+       << "         [--save-state (char*)state-file] \\ " << endl
+       << "         [--load-state (char*)state-file  (input is a delta)] \\ " 
+       << endl
+       << "         [--inventory (char*)station-inventory-file] \\ " << endl
+       << "         [--grid latlon|equal-area] "
+       << "[--cell-size (double)degrees] \\ " << endl
+       << "         [--country code[,code...]  (number or FIPS letters)] \\ " 
+       << endl
+       << "         [--region (double)lat0,lat1,lon0,lon1] \\ " << endl
+       << "         [--queries (char*)query-file  (one input file)] \\ " << endl
+       << "         [--serve (char*)socket-path  (query server)] \\ " << endl
+       << "         [--arrow (char*)output-file-prefix] \\ " << endl
+       << "         (char*)GHCN-file1 (char*)GHCN-file2... " << endl
+       << endl
+       << "   or: " << prog << " --bench [options]  (-h for the options)" 
+       << endl << endl;
+}
+
+void ProcessOptions(int argc, char **argv)
+{
+  int optRtn;
+
+  // Long options that have no short form.
+  enum { OPT_STATS=256, OPT_DUPLICATES, OPT_LOAD_STATE, OPT_SAVE_STATE,
+         OPT_INVENTORY, OPT_GRID, OPT_CELL_SIZE, OPT_COUNTRY, OPT_REGION,
+         OPT_QUERIES, OPT_BASELINE, OPT_SERVE, OPT_ARROW, OPT_QC_FLAGGED,
+         OPT_DAILY_ELEMENT, OPT_MIN_DAYS };
+  static const struct option longOpts[]=
+  {
+    { "stats", required_argument, NULL, OPT_STATS },
+    { "duplicates", required_argument, NULL, OPT_DUPLICATES },
+    { "load-state", required_argument, NULL, OPT_LOAD_STATE },
+    { "save-state", required_argument, NULL, OPT_SAVE_STATE },
+    { "inventory", required_argument, NULL, OPT_INVENTORY },
+    { "grid", required_argument, NULL, OPT_GRID },
+    { "cell-size", required_argument, NULL, OPT_CELL_SIZE },
+    { "country", required_argument, NULL, OPT_COUNTRY },
+    { "region", required_argument, NULL, OPT_REGION },
+    { "queries", required_argument, NULL, OPT_QUERIES },
+    { "baseline", required_argument, NULL, OPT_BASELINE },
+    { "serve", required_argument, NULL, OPT_SERVE },
+    { "arrow", required_argument, NULL, OPT_ARROW },
+    { "qc-flagged", required_argument, NULL, OPT_QC_FLAGGED },
+    { "daily-element", required_argument, NULL, OPT_DAILY_ELEMENT },
+    { "min-days", required_argument, NULL, OPT_MIN_DAYS },
+    { NULL, 0, NULL, 0 }
+  };
+
+  if(argc<2)
+  {
+    PrintUsage(argv[0]);
+    exit(1);
+  }
+  
+  minBaselineSampleCount_g=GHCN::DEFAULT_MIN_BASELINE_SAMPLE_COUNT;
+  avgNyear_g=GHCN::DEFAULT_AVG_NYEAR;
+  numJobs_g=1;
+  streaming_g=false;
+  duplicateMode_g=GHCN::DUPLICATES_SEPARATE;
+  dropQcFlagged_g=true;
+  dailyElement_g=GHCN::DAILY_TAVG;
+  minDaysPerMonth_g=GHCN::DEFAULT_MIN_DAYS_PER_MONTH;
+  gridded_g=false;
+  gridType_g=GHCNGrid::GRID_LATLON;
+  cellDegrees_g=5.0;
+  hasRegion_g=false;
+  firstBaselineYear_g=GHCN::FIRST_BASELINE_YEAR;
+  lastBaselineYear_g=GHCN::LAST_BASELINE_YEAR;
+  
+  while ((optRtn=getopt_long(argc,argv,"A:B:j:c:S",longOpts,NULL))!=-1)
+  {
+    switch(optRtn)
+    {
+      case 'A':
+	avgNyear_g=atoi(optarg);
+	break;
+	
+      case 'B':
+	minBaselineSampleCount_g=atoi(optarg);
+	break;
+	
+      case 'j':
+	numJobs_g=atoi(optarg);
+	break;
+	
+      case 'c':
+	cacheDir_g=optarg;
+	break;
+	
+      case 'S':
+	streaming_g=true;
+	break;
+	
+      case OPT_STATS:
+	statsFile_g=optarg;
+	break;
+	
+      case OPT_DUPLICATES:
+	if(strcmp(optarg,"separate")==0)
+	{
+	  duplicateMode_g=GHCN::DUPLICATES_SEPARATE;
+	}
+	else if(strcmp(optarg,"combine")==0)
+	{
+	  duplicateMode_g=GHCN::DUPLICATES_COMBINE;
+	}
+	else
+	{
+	  PrintUsage(argv[0]);
+	  exit(1);
+	}
+	break;
+	
+      case OPT_LOAD_STATE:
+	loadState_g=optarg;
+	break;
+	
+      case OPT_SAVE_STATE:
+	saveState_g=optarg;
+	break;
+	
+      case OPT_INVENTORY:
+	inventoryFile_g=optarg;
+	break;
+	
+      case OPT_GRID:
+	gridded_g=true;
+	if(strcmp(optarg,"latlon")==0)
+	{
+	  gridType_g=GHCNGrid::GRID_LATLON;
+	}
+	else if(strcmp(optarg,"equal-area")==0)
+	{
+	  gridType_g=GHCNGrid::GRID_EQUAL_AREA;
+	}
+	else
+	{
+	  PrintUsage(argv[0]);
+	  exit(1);
+	}
+	break;
+	
+      case OPT_CELL_SIZE:
+	gridded_g=true;
+	cellDegrees_g=atof(optarg);
+	break;
+	
+      case OPT_COUNTRY:
+	{
+	  // Comma-separated list of country codes.
+	  if(!GHCNParseCountryList(optarg, countries_g))
+	  {
+	    cerr << "--country needs GHCN country numbers or 2-letter FIPS "
+		 << "codes, comma-separated: " << optarg << endl;
+	    exit(1);
+	  }
+	}
+	break;
+	
+      case OPT_REGION:
+	if(sscanf(optarg, "%lf,%lf,%lf,%lf", &region_g.lat0, &region_g.lat1,
+		  &region_g.lon0, &region_g.lon1)!=4
+	   || region_g.lat0>region_g.lat1)
+	{
+	  cerr << "--region wants lat0,lat1,lon0,lon1 (degrees, lat0<=lat1)"
+	       << endl;
+	  exit(1);
+	}
+	hasRegion_g=true;
+	break;
+	
+      case OPT_QUERIES:
+	queryFile_g=optarg;
+	break;
+	
+      case OPT_SERVE:
+	serveSocket_g=optarg;
+	break;
+	
+      case OPT_ARROW:
+	arrowPrefix_g=optarg;
+	break;
+	
+      case OPT_QC_FLAGGED:
+	if(strcmp(optarg,"drop")==0)
+	{
+	  dropQcFlagged_g=true;
+	}
+	else if(strcmp(optarg,"keep")==0)
+	{
+	  dropQcFlagged_g=false;
+	}
+	else
+	{
+	  PrintUsage(argv[0]);
+	  exit(1);
+	}
+	break;
+	
+      case OPT_DAILY_ELEMENT:
+	if(strcmp(optarg,"TAVG")==0)
+	{
+	  dailyElement_g=GHCN::DAILY_TAVG;
+	}
+	else if(strcmp(optarg,"TMAX")==0)
+	{
+	  dailyElement_g=GHCN::DAILY_TMAX;
+	}
+	else if(strcmp(optarg,"TMIN")==0)
+	{
+	  dailyElement_g=GHCN::DAILY_TMIN;
+	}
+	else
+	{
+	  PrintUsage(argv[0]);
+	  exit(1);
+	}
+	break;
+	
+      case OPT_MIN_DAYS:
+	minDaysPerMonth_g=atoi(optarg);
+	if(minDaysPerMonth_g<1 || minDaysPerMonth_g>31)
+	{
+	  cerr << "--min-days must be between 1 and 31" << endl;
+	  exit(1);
+	}
+	break;
+	
+      case OPT_BASELINE:
+	if(sscanf(optarg, "%d-%d", &firstBaselineYear_g, 
+		  &lastBaselineYear_g)!=2
+	   || firstBaselineYear_g>lastBaselineYear_g)
+	{
+	  cerr << "--baseline wants first-last (years, first<=last)" << endl;
+	  exit(1);
+	}
+	break;
+	
+      default:
+	PrintUsage(argv[0]);
+	exit(1);
+    }
+  }
+  avgNyear_g=MAX(1,MIN(GHCN::MAX_AVG_NYEAR,avgNyear_g));
+  minBaselineSampleCount_g=MAX(1,
+     MIN(lastBaselineYear_g-firstBaselineYear_g+1,
+	 minBaselineSampleCount_g));
+  if(numJobs_g<=0)
+  {
+    numJobs_g=GHCNHardwareThreads();
+  }
+
+  // There's only one standard input to go round.
+  if(count(argv+optind, argv+argc, string("-"))>1)
+  {
+    cerr << "- (standard input) can only be given once" << endl;
+    exit(1);
+  }
+
+  if(!loadState_g.empty() || !saveState_g.empty())
+  {
+    // A state file holds one input file's worth of data.
+    if(argc-optind!=1 || streaming_g)
+    {
+      cerr << "--load-state and --save-state need exactly one input file, "
+	   << "and can't be used with -S" << endl;
+      exit(1);
+    }
+  }
+
+  // Queries share one parsed dataset, so there's only room for one
+  // input file, and it has to be read in full.
+  if(!queryFile_g.empty()
+     && (argc-optind!=1 || streaming_g 
+	 || !loadState_g.empty() || !saveState_g.empty()))
+  {
+    cerr << "--queries needs exactly one input file, and can't be used "
+	 << "with -S, --load-state or --save-state" << endl;
+    exit(1);
+  }
+
+  if(!serveSocket_g.empty()
+     && (streaming_g || !loadState_g.empty() || !saveState_g.empty()
+	 || !queryFile_g.empty()))
+  {
+    cerr << "--serve can't be used with -S, --load-state, --save-state "
+	 << "or --queries" << endl;
+    exit(1);
+  }
+
+  if(!arrowPrefix_g.empty() && (!queryFile_g.empty() || !serveSocket_g.empty()))
+  {
+    cerr << "--arrow can't be used with --queries or --serve" << endl;
+    exit(1);
+  }
+
+  if((gridded_g || hasRegion_g) && inventoryFile_g.empty())
+  {
+    cerr << "--grid, --cell-size and --region need --inventory" << endl;
+    exit(1);
+  }
+
+  // A state file has to hold all the stations, and there's no way to
+  // grid its unweighted sums.
+  if((gridded_g || hasRegion_g || !countries_g.empty())
+     && (!loadState_g.empty() || !saveState_g.empty()))
+  {
+    cerr << "--grid, --country and --region can't be used with "
+	 << "--load-state or --save-state" << endl;
+    exit(1);
+  }
+
+  if(gridded_g)
+  {
+    // The gridded average needs every station's anomalies at once.
+    if(streaming_g)
+    {
+      cerr << "--grid can't be used with -S" << endl;
+      exit(1);
+    }
+    if(cellDegrees_g<0.1 || cellDegrees_g>90.0)
+    {
+      cerr << "--cell-size must be between 0.1 and 90 degrees" << endl;
+      exit(1);
+    }
+  }
+  
+}
+
+// Progress messages from concurrently-processed files go through here
+// so that their lines don't get mixed together.
+static mutex progressMutex_g;
+
+static void Progress(const string& msg)
+{
+  lock_guard<mutex> lock(progressMutex_g);
+  cerr << msg << endl;
+}
+
+// Are the files only read in, for queries to be run on?
+static bool QueryMode(void)
+{
+  return !queryFile_g.empty() || !serveSocket_g.empty();
+}
+
+// Query settings not given in a query come from the command line.
+static GHCNQuery QueryDefaults(void)
+{
+  GHCNQuery defaults;
+  defaults.avgNyear=avgNyear_g;
+  defaults.minBaselineSampleCount=minBaselineSampleCount_g;
+  defaults.firstBaselineYear=firstBaselineYear_g;
+  defaults.lastBaselineYear=lastBaselineYear_g;
+  defaults.countries=countries_g;
+  defaults.hasRegion=hasRegion_g;
+  defaults.region=region_g;
+  return defaults;
+}
+
+// Run the whole analysis pipeline for one input file.
+void ProcessFile(GHCN **ghcn, int igh, const char *fileName, int numThreads,
+                 GHCNStats& stats)
+{
+  string name(fileName);
+
+  stats.StartStage("open");
+  ghcn[igh] = new GHCN(fileName,avgNyear_g);
+  ghcn[igh]->SetNumThreads(numThreads);
+  ghcn[igh]->SetCacheDir(cacheDir_g);
+  ghcn[igh]->SetDuplicateMode(duplicateMode_g);
+  ghcn[igh]->SetDropQcFlagged(dropQcFlagged_g);
+  ghcn[igh]->SetDailyOptions(dailyElement_g, minDaysPerMonth_g);
+  ghcn[igh]->SetGrid(inventory_g, grid_g);
+  ghcn[igh]->SetBaselineWindow(firstBaselineYear_g, lastBaselineYear_g);
+  if(!QueryMode())
+  {
+    // (With queries, --country and --region are only query defaults.)
+    ghcn[igh]->SetFilter(countries_g, hasRegion_g ? &region_g : NULL);
+  }
+  stats.EndStage();
+
+  if(ghcn[igh]->Compression()!=GHCN_COMPRESSION_NONE)
+  {
+    Progress(name + " is " + GHCNCompressionName(ghcn[igh]->Compression())
+	     + "-compressed;  decompressing it as it's read");
+  }
+
+  if(ghcn[igh]->NumDailyFiles()>0)
+  {
+    ostringstream msg;
+    msg << name << " has " << ghcn[igh]->NumDailyFiles() 
+	<< " GHCN-Daily station files";
+    Progress(msg.str());
+  }
+  else if(ghcn[igh]->Format()==GHCN_FORMAT_DAILY)
+  {
+    Progress(name + " is in the GHCN-Daily format");
+  }
+  else if(ghcn[igh]->Format()!=GHCN_FORMAT_V2)
+  {
+    Progress(name + " is in the GHCN-M " 
+	     + GHCNFormatName(ghcn[igh]->Format()) + " format");
+  }
+
+  // v4 and daily station IDs start with a FIPS code, v2 and v3 ones 
+  // with a country number;  a code of the other kind would pick out
+  // nothing.
+  bool fipsIds=(ghcn[igh]->Format()==GHCN_FORMAT_V4
+		|| ghcn[igh]->Format()==GHCN_FORMAT_DAILY);
+  for(size_t ic=0; ic<countries_g.size(); ic++)
+  {
+    if(GHCNStationIsAlnum(countries_g[ic])!=fipsIds)
+    {
+      cerr << name << " has " 
+	   << (fipsIds ? "2-letter FIPS" : "numeric GHCN") 
+	   << " country codes;  use those with --country" << endl;
+      exit(1);
+    }
+  }
+  
+  if(!loadState_g.empty())
+  {
+    Progress("Loading state from " + loadState_g);
+    stats.StartStage("LoadState");
+    bool ok=ghcn[igh]->LoadState(loadState_g, minBaselineSampleCount_g);
+    stats.EndStage();
+    if(!ok)
+    {
+      exit(1);
+    }
+
+    Progress("Applying updates from " + name);
+    stats.StartStage("ApplyDelta");
+    ghcn[igh]->ApplyDelta(minBaselineSampleCount_g);
+    stats.EndStage();
+  }
+  else if(streaming_g)
+  {
+    Progress("Streaming baseline temps and average anomalies for " + name);
+    stats.StartStage("StreamTemps");
+    ghcn[igh]->StreamTemps(minBaselineSampleCount_g);
+    stats.EndStage();
+  }
+  else if(QueryMode())
+  {
+    Progress("Reading data from " + name);
+    stats.StartStage("ReadTemps");
+    ghcn[igh]->ReadTemps();
+    stats.EndStage();
+
+    if(!queries_g.empty())
+    {
+      ostringstream msg;
+      msg << "Running " << queries_g.size() << " queries on " << name;
+      Progress(msg.str());
+      GHCNRunQueries(*ghcn[igh], queries_g, cout, stats);
+      stats.AddCounter("queries", queries_g.size());
+    }
+  }
+  else
+  {
+    Progress("Reading data from " + name);
+    stats.StartStage("ReadTemps");
+    ghcn[igh]->ReadTemps();
+    stats.EndStage();
+    if(ghcn[igh]->LoadedFromCache())
+    {
+      Progress("  (loaded parsed data from cache)");
+    }
+    
+    Progress("Computing baseline temps for " + name);
+    stats.StartStage("ComputeBaselines");
+    ghcn[igh]->ComputeBaselines();
+    stats.EndStage();
+    
+    Progress("Computing average anomalies for " + name);
+    stats.StartStage("ComputeGlobalAverageAnomalies");
+    ghcn[igh]->ComputeGlobalAverageAnomalies(minBaselineSampleCount_g);
+    stats.EndStage();
+  }
+    
+  if(!QueryMode())
+  {
+    stats.StartStage("MergeMonthsToYear");
+    ghcn[igh]->MergeMonthsToYear(GHCN::MERGE_AVG);
+    stats.EndStage();
+    
+    ostringstream msg;
+    msg << "Computing " << avgNyear_g << "-year moving averages for " 
+	<< name;
+    Progress(msg.str());
+    stats.StartStage("ComputeMovingAvg");
+    ghcn[igh]->ComputeMovingAvg(avgNyear_g);
+    stats.EndStage();
+  }
+
+  if(!saveState_g.empty())
+  {
+    Progress("Saving state to " + saveState_g);
+    stats.StartStage("SaveState");
+    bool ok=ghcn[igh]->SaveState(saveState_g);
+    stats.EndStage();
+    if(!ok)
+    {
+      exit(1);
+    }
+  }
+
+  const GHCN::ParseCounts& counts=ghcn[igh]->Counts();
+  const GHCNTempStore& store=ghcn[igh]->TempStore();
+  stats.AddCounter("lines", counts.lines);
+  stats.AddCounter("malformed_lines", counts.malformed);
+  // (GHCN-M version 2, 3 or 4;  0 for GHCN-Daily.)
+  stats.AddCounter("input_format_version", 
+                   ghcn[igh]->Format()==GHCN_FORMAT_DAILY 
+		   ? 0 : 2+(int)ghcn[igh]->Format());
+  stats.AddCounter("daily_files", ghcn[igh]->NumDailyFiles());
+  // (0 plain, 1 compress (.Z), 2 gzip.)
+  stats.AddCounter("input_compression", (int)ghcn[igh]->Compression());
+  stats.AddCounter("values_qc_flagged", counts.qcFlagged);
+  stats.AddCounter("records_accepted", counts.records);
+  stats.AddCounter("records_rejected_min_year", counts.rejectedYear);
+  stats.AddCounter("stations_kept", ghcn[igh]->StationsKept());
+  stats.AddCounter("stations_dropped", ghcn[igh]->StationsDropped());
+  stats.AddCounter("store_stations", store.NumStations());
+  stats.AddCounter("store_rows", store.NumRows());
+  stats.AddCounter("store_bytes", store.MemoryBytes());
+  stats.AddCounter("baseline_bytes", ghcn[igh]->BaselineBytes());
+  stats.AddCounter("scratch_bytes", ghcn[igh]->ScratchBytes());
+  stats.AddCounter("anomaly_years", ghcn[igh]->AnomalyNumYears());
+  stats.AddCounter("annual_anomalies", ghcn[igh]->NumAnnualAnomalies());
+  stats.AddCounter("smoothed_anomalies",
+                   ghcn[igh]->mSmoothedGlobalAverageAnnualAnomalies.size());
+  stats.AddCounter("loaded_from_cache", ghcn[igh]->LoadedFromCache());
+  stats.AddCounter("stations_filtered_out", ghcn[igh]->StationsFilteredOut());
+  stats.AddCounter("stations_unlocated", ghcn[igh]->StationsUnlocated());
+  stats.AddCounter("grid_cells_used", ghcn[igh]->GridCellsUsed());
+  stats.AddCounter("delta_stations", ghcn[igh]->DeltaStations());
+  stats.AddCounter("baselines_recomputed", ghcn[igh]->BaselinesRecomputed());
+
+  Progress("Finished " + name + "\n");
+}
+
+// Write the --stats report:  run settings, then each file's stages and
+// counters, then the stages that cover all the files.
+void WriteStats(ostream& os, char **fileNames, int nfiles,
+                const vector<GHCNStats>& fileStats, const GHCNStats& runStats,
+                int threadsPerFile)
+{
+  os << "{" << endl
+     << "  \"jobs\": " << numJobs_g << "," << endl
+     << "  \"threads_per_file\": " << threadsPerFile << "," << endl
+     << "  \"streaming\": " << (streaming_g ? "true" : "false") << "," << endl
+     << "  \"min_baseline_sample_count\": " << minBaselineSampleCount_g 
+     << "," << endl
+     << "  \"avg_nyear\": " << avgNyear_g << "," << endl
+     << "  \"baseline_first_year\": " << firstBaselineYear_g << "," << endl
+     << "  \"baseline_last_year\": " << lastBaselineYear_g << "," << endl
+     << "  \"parse_kernel\": " << GHCNJsonString(GHCNParseTemps12Kernel())
+     << "," << endl
+     << "  \"qc_flagged\": " << (dropQcFlagged_g ? "\"drop\"" : "\"keep\"")
+     << "," << endl
+     << "  \"daily_element\": " 
+     << GHCNJsonString(GHCN::DailyElementName(dailyElement_g)) << "," << endl
+     << "  \"min_days_per_month\": " << minDaysPerMonth_g << "," << endl
+     << "  \"files\": [";
+  for(int igh=0; igh<nfiles; igh++)
+  {
+    os << (igh>0 ? "," : "") << endl
+       << "    {" << endl
+       << "      \"file\": " << GHCNJsonString(fileNames[igh]) << "," << endl;
+    fileStats[igh].WriteJsonMembers(os, "      ");
+    os << endl << "    }";
+  }
+  os << endl << "  ]," << endl
+     << "  \"run\": {" << endl;
+  runStats.WriteJsonMembers(os, "    ");
+  os << endl << "  }" << endl
+     << "}" << endl;
+}
+
+// Year-by-year series, one column per input file, aligned on the years
+// any of them has (nulls where a file has none).
+static void AddSeriesColumns(GHCNArrowWriter& table, 
+                             const vector<const map<int,double>*>& series,
+                             char **fileNames)
+{
+  set<int> yearSet;
+  for(size_t igh=0; igh<series.size(); igh++)
+  {
+    for(map<int,double>::const_iterator it=series[igh]->begin();
+	it!=series[igh]->end(); it++)
+    {
+      yearSet.insert(it->first);
+    }
+  }
+  vector<int32_t> years(yearSet.begin(), yearSet.end());
+  table.AddColumn("year", years);
+
+  vector<double> values(years.size());
+  vector<unsigned char> valid(years.size());
+  for(size_t igh=0; igh<series.size(); igh++)
+  {
+    for(size_t iy=0; iy<years.size(); iy++)
+    {
+      map<int,double>::const_iterator it=series[igh]->find(years[iy]);
+      valid[iy]=(it!=series[igh]->end());
+      values[iy]=valid[iy] ? it->second : 0.0;
+    }
+    table.AddColumn(fileNames[igh], values, valid);
+  }
+}
+
+// --arrow:  monthly anomalies and station counts, annual anomalies and
+// smoothed anomalies, as three Arrow files.
+bool WriteArrowResults(GHCN **ghcn, int ngh, char **fileNames, 
+                       const string& prefix)
+{
+  // Monthly rows cover every year any file has.
+  int firstYear=0, lastYear=-1;
+  for(int igh=0; igh<ngh; igh++)
+  {
+    if(ghcn[igh]->AnomalyNumYears()==0)
+    {
+      continue;
+    }
+    int fy=ghcn[igh]->AnomalyFirstYear();
+    int ly=fy+ghcn[igh]->AnomalyNumYears()-1;
+    if(lastYear<firstYear)
+    {
+      firstYear=fy;
+      lastYear=ly;
+    }
+    firstYear=MIN(firstYear, fy);
+    lastYear=MAX(lastYear, ly);
+  }
+  size_t nrows=12*(size_t)MAX(0, lastYear-firstYear+1);
+
+  GHCNArrowWriter monthly;
+  vector<int32_t> years(nrows), months(nrows);
+  for(size_t ir=0; ir<nrows; ir++)
+  {
+    years[ir]=firstYear+(int)(ir/12);
+    months[ir]=(int)(ir%12)+1;
+  }
+  monthly.AddColumn("year", years);
+  monthly.AddColumn("month", months);
+
+  vector<double> anomalies(nrows);
+  vector<unsigned char> valid(nrows);
+  vector<int32_t> stations(nrows);
+  for(int igh=0; igh<ngh; igh++)
+  {
+    const vector<double>& mm=ghcn[igh]->MonthlyAnomalies();
+    const vector<int>& count=ghcn[igh]->MonthlyStationCounts();
+    size_t offset=12*(size_t)(ghcn[igh]->AnomalyFirstYear()-firstYear);
+    size_t nym=12*(size_t)ghcn[igh]->AnomalyNumYears();
+
+    fill(anomalies.begin(), anomalies.end(), 0.0);
+    fill(valid.begin(), valid.end(), 0);
+    fill(stations.begin(), stations.end(), 0);
+    for(size_t iym=0; iym<nym; iym++)
+    {
+      valid[offset+iym]=(mm[iym]>GHCN::GHCN_NOTEMP()+GHCN::ERR_EPS());
+      anomalies[offset+iym]=valid[offset+iym] ? mm[iym] : 0.0;
+      stations[offset+iym]=count[iym];
+    }
+    monthly.AddColumn(fileNames[igh], anomalies, valid);
+    monthly.AddColumn(string(fileNames[igh])+" stations", stations);
+  }
+
+  GHCNArrowWriter annual, smoothed;
+  vector<const map<int,double>*> annualSeries, smoothedSeries;
+  for(int igh=0; igh<ngh; igh++)
+  {
+    annualSeries.push_back(&ghcn[igh]->AnnualAnomalies());
+    smoothedSeries.push_back(&ghcn[igh]->mSmoothedGlobalAverageAnnualAnomalies);
+  }
+  AddSeriesColumns(annual, annualSeries, fileNames);
+  AddSeriesColumns(smoothed, smoothedSeries, fileNames);
+
+  return monthly.Write(prefix+".monthly.arrow")
+    && annual.Write(prefix+".annual.arrow")
+    && smoothed.Write(prefix+".smoothed.arrow");
+}
+
+
+
+int main(int argc, char **argv)
+{
+
+  // GHCN* ghcn[MAXFILES];
+  
+//  int ProcessOptions(int argc, char **argv);
+  
+  void DumpSmoothedResults(GHCN **ghcn, int nghcn);
+
+  if(argc>1 && strcmp(argv[1],"--bench")==0)
+  {
+    return GHCNBenchmark(argc-1, argv+1);
+  }
+
+  ProcessOptions(argc,argv);
+  
+  // if(argc-optind>MAXFILES)
+  // {
+  //   cerr << "Too many input file args" << endl;
+  //   exit(1);
+  // }
+  
+  
+  cerr << endl 
+       << "Smoothing filter length = " << avgNyear_g 
+       << endl << endl;
+  
+  cerr << endl
+       << "Will crunch " << argc-optind << " temperature files. " 
+       << endl << endl;
+  
+  GHCN** ghcn = new GHCN*[argc-optind];
+
+  inventory_g=NULL;
+  grid_g=NULL;
+  if(!inventoryFile_g.empty())
+  {
+    inventory_g=new GHCNInventory;
+    if(!inventory_g->Load(inventoryFile_g.c_str()))
+    {
+      cerr << "Failed to read station inventory " << inventoryFile_g << endl;
+      exit(1);
+    }
+    cerr << "Station inventory " << inventoryFile_g << ": " 
+	 << inventory_g->NumStations() << " stations located, " 
+	 << inventory_g->NumSkipped() << " lines skipped" << endl;
+    if(gridded_g)
+    {
+      grid_g=new GHCNGrid(gridType_g, cellDegrees_g);
+      cerr << "Averaging over " << grid_g->NumCells() << " grid cells" 
+	   << endl;
+    }
+    cerr << endl;
+  }
+
+  if(!queryFile_g.empty())
+  {
+    if(!GHCNReadQueries(queryFile_g.c_str(), QueryDefaults(), 
+			inventory_g!=NULL, queries_g))
+    {
+      exit(1);
+    }
+    cerr << queries_g.size() << " queries in " << queryFile_g 
+	 << endl << endl;
+  }
+  
+
+  // Crunch the GHCN file command-line args, up to numJobs_g at a time.
+  // Each file gets its own slot in ghcn[], so results come out in
+  // command-line order no matter which file finishes first.
+  // Cores left over once every file has a job slot are split between
+  // the files, for parsing and analysing each one in parallel.
+  int nfiles=argc-optind;
+  int fileJobs=MIN(numJobs_g,nfiles);
+  int threadsPerFile=MAX(1,numJobs_g/MAX(1,fileJobs));
+  vector<GHCNStats> fileStats(nfiles);
+  GHCNStats runStats;
+  runStats.StartStage("crunch");
+  GHCNParallelFor(nfiles, fileJobs, [&](int igh)
+  {
+    ProcessFile(ghcn, igh, argv[igh+optind], threadsPerFile, fileStats[igh]);
+  });
+  runStats.EndStage();
+
+  cerr << endl;
+  
+  if(!serveSocket_g.empty())
+  {
+    vector<GHCN*> datasets(ghcn, ghcn+nfiles);
+    vector<string> names(argv+optind, argv+argc);
+    runStats.StartStage("serve");
+    bool ok=GHCNServe(serveSocket_g.c_str(), datasets, names, 
+		      QueryDefaults(), inventory_g!=NULL);
+    runStats.EndStage();
+    if(!ok)
+    {
+      exit(1);
+    }
+  }
+  else
+  {
+    cerr << "Dumping results... " << endl<<endl<<endl;
+  
+    runStats.StartStage("output");
+    if(queries_g.empty())
+    {
+      // (The query results were written as the queries ran.)
+      DumpSmoothedResults(ghcn, argc-optind);
+    }
+    cout.flush();
+    runStats.EndStage();
+
+    if(!arrowPrefix_g.empty())
+    {
+      runStats.StartStage("arrow");
+      if(!WriteArrowResults(ghcn, nfiles, argv+optind, arrowPrefix_g))
+      {
+	cerr << "Couldn't write the Arrow files " << arrowPrefix_g 
+	     << ".*.arrow" << endl;
+      }
+      runStats.EndStage();
+    }
+  }
+
+  if(statsFile_g=="-")
+  {
+    WriteStats(cerr, argv+optind, nfiles, fileStats, runStats, 
+               threadsPerFile);
+  }
+  else if(!statsFile_g.empty())
+  {
+    ofstream statsOut(statsFile_g.c_str());
+    WriteStats(statsOut, argv+optind, nfiles, fileStats, runStats, 
+               threadsPerFile);
+    if(!statsOut)
+    {
+      cerr << "Couldn't write stats to " << statsFile_g << endl;
+    }
+  }
+
+  // (The old commented-out version of this loop stepped argc instead
+  // of igh, so it deleted ghcn[0] over and over -- hence the segfaults.)
+  for(int igh=0; igh<nfiles; igh++)
+  {
+    delete ghcn[igh];
+  }
+  delete[] ghcn;
+  delete grid_g;
+  delete inventory_g;
+  
+  
+  return 0;
+  
+}
@@ -0,0 +1,443 @@
+#include "GHCNoutput.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+
+using namespace std;
+
+
+GHCNCsvWriter::GHCNCsvWriter(ostream& out)
+  : mOut(out), mBuffer(BUFFER_BYTES), mUsed(0)
+{
+}
+
+GHCNCsvWriter::~GHCNCsvWriter()
+{
+  Flush();
+}
+
+void GHCNCsvWriter::Append(const char *text, size_t nn)
+{
+  if(mUsed+nn>mBuffer.size())
+  {
+    mOut.write(mBuffer.data(), mUsed);
+    mUsed=0;
+    if(nn>mBuffer.size())
+    {
+      mOut.write(text, nn);
+      return;
+    }
+  }
+  memcpy(&mBuffer[mUsed], text, nn);
+  mUsed+=nn;
+}
+
+void GHCNCsvWriter::Put(int value)
+{
+  char text[16];
+  Append(text, snprintf(text, sizeof(text), "%d", value));
+}
+
+void GHCNCsvWriter::Put(double value)
+{
+  // %g is what << does with the default precision of 6.
+  char text[32];
+  Append(text, snprintf(text, sizeof(text), "%g", value));
+}
+
+void GHCNCsvWriter::Put(char cc)
+{
+  Append(&cc, 1);
+}
+
+void GHCNCsvWriter::Put(const string& text)
+{
+  Append(text.data(), text.size());
+}
+
+void GHCNCsvWriter::Flush(void)
+{
+  mOut.write(mBuffer.data(), mUsed);
+  mUsed=0;
+  mOut.flush();
+}
+
+
+//
+// Arrow IPC file layout (see the Arrow "Columnar Format" spec):
+//
+//   "ARROW1\0\0"
+//   schema message
+//   record batch message, then its body (the column buffers)
+//   end-of-stream marker
+//   footer, its length, "ARROW1"
+//
+// Each message is 0xFFFFFFFF, the metadata length and a flatbuffer
+// Message;  the footer is a flatbuffer Footer.  The flatbuffers are
+// built by hand below -- only the handful of tables needed for
+// int32 and double columns.
+//
+
+namespace
+{
+
+// Arrow's flatbuffer enum values (Schema.fbs, Message.fbs).
+const int16_t METADATA_V5=4;
+const uint8_t HEADER_SCHEMA=1;
+const uint8_t HEADER_RECORD_BATCH=3;
+const uint8_t TYPE_INT=2;
+const uint8_t TYPE_FLOATING_POINT=3;
+const int16_t PRECISION_DOUBLE=2;
+
+size_t Pad8(size_t nn)
+{
+  return (nn+7)&~(size_t)7;
+}
+
+// Flatbuffer built front to back:  a table is written before the
+// things it points to, and its offsets are filled in with Link() once
+// they've been written.  Every scalar is aligned to its own size.
+class FlatBuffer
+{
+ public:
+
+  explicit FlatBuffer(vector<uint8_t>& bytes) : mBytes(bytes)
+  {
+    mBytes.clear();
+    Reserve(4, 4);    // offset to the root table
+  }
+
+  size_t Size(void) const { return mBytes.size(); }
+
+  // nn zero bytes, aligned;  returns where they start.
+  size_t Reserve(size_t nn, size_t align)
+  {
+    while(mBytes.size()%align)
+    {
+      mBytes.push_back(0);
+    }
+    size_t pos=mBytes.size();
+    mBytes.resize(pos+nn, 0);
+    return pos;
+  }
+
+  template<class T>
+  void  Set(size_t pos, T value) { memcpy(&mBytes[pos], &value, sizeof(T)); }
+
+  // Point the offset at pos to target.
+  void  Link(size_t pos, size_t target)
+    { Set<uint32_t>(pos, (uint32_t)(target-pos)); }
+
+  void  SetRoot(size_t table) { Link(0, table); }
+
+  // A table with fields of the given sizes in bytes (0 = left out);
+  // field[ii] gets where field ii is.  Returns where the table is.
+  size_t Table(const int *sizes, int nfields, size_t *field)
+  {
+    size_t vtable=Reserve(4+2*nfields, 2);
+    size_t table=Reserve(4, 8);
+    Set<int32_t>(table, (int32_t)(table-vtable));
+    Set<uint16_t>(vtable, (uint16_t)(4+2*nfields));
+    for(int ii=0; ii<nfields; ii++)
+    {
+      field[ii]=0;
+      if(sizes[ii]>0)
+      {
+	field[ii]=Reserve(sizes[ii], sizes[ii]);
+	Set<uint16_t>(vtable+4+2*ii, (uint16_t)(field[ii]-table));
+      }
+    }
+    Set<uint16_t>(vtable+2, (uint16_t)(Size()-table));
+    return table;
+  }
+
+  // A vector of nn elements;  returns where its length is (which is
+  // what offsets point to), with the elements straight after.
+  size_t Vector(size_t nn, size_t elemSize, size_t elemAlign)
+  {
+    while((Size()+4)%elemAlign || Size()%4)
+    {
+      mBytes.push_back(0);
+    }
+    size_t pos=Reserve(4, 4);
+    Set<uint32_t>(pos, (uint32_t)nn);
+    Reserve(nn*elemSize, 1);
+    return pos;
+  }
+
+  size_t String(const string& text)
+  {
+    size_t pos=Reserve(4, 4);
+    Set<uint32_t>(pos, (uint32_t)text.size());
+    size_t chars=Reserve(text.size()+1, 1);
+    memcpy(&mBytes[chars], text.data(), text.size());
+    return pos;
+  }
+
+ private:
+  vector<uint8_t>& mBytes;
+};
+
+// Message table:  version, header_type, header, bodyLength.
+size_t MessageTable(FlatBuffer& fb, uint8_t headerType, int64_t bodyLength,
+                    size_t& headerField)
+{
+  static const int sizes[]={ 2, 1, 4, 8 };
+  size_t field[4];
+  size_t table=fb.Table(sizes, 4, field);
+  fb.Set<int16_t>(field[0], METADATA_V5);
+  fb.Set<uint8_t>(field[1], headerType);
+  fb.Set<int64_t>(field[3], bodyLength);
+  headerField=field[2];
+  return table;
+}
+
+void WriteMessage(ostream& out, vector<uint8_t>& fb)
+{
+  fb.resize(Pad8(fb.size()), 0);
+  uint32_t marker=0xFFFFFFFF;
+  int32_t length=(int32_t)fb.size();
+  out.write((const char*)&marker, 4);
+  out.write((const char*)&length, 4);
+  out.write((const char*)fb.data(), fb.size());
+}
+
+void WritePadded(ostream& out, const char *data, size_t nn)
+{
+  static const char zeros[8]={ 0 };
+  out.write(data, nn);
+  out.write(zeros, Pad8(nn)-nn);
+}
+
+}
+
+
+void GHCNArrowWriter::AddColumn(const string& name,
+                                const vector<int32_t>& values)
+{
+  Column col;
+  col.name=name;
+  col.isDouble=false;
+  col.nullable=false;
+  col.length=values.size();
+  col.nullCount=0;
+  col.values.resize(values.size()*sizeof(int32_t));
+  if(!values.empty())
+  {
+    memcpy(col.values.data(), values.data(), col.values.size());
+  }
+  mColumns.push_back(col);
+}
+
+void GHCNArrowWriter::AddColumn(const string& name,
+                                const vector<double>& values,
+                                const vector<unsigned char>& valid)
+{
+  Column col;
+  col.name=name;
+  col.isDouble=true;
+  col.nullable=!valid.empty();
+  col.length=values.size();
+  col.nullCount=0;
+  col.values.resize(values.size()*sizeof(double));
+  if(!values.empty())
+  {
+    memcpy(col.values.data(), values.data(), col.values.size());
+  }
+
+  if(!valid.empty())
+  {
+    // Bit ii (least significant first) set if value ii isn't null.
+    col.validity.assign((values.size()+7)/8, 0);
+    for(size_t ii=0; ii<values.size(); ii++)
+    {
+      if(valid[ii])
+      {
+	col.validity[ii/8]|=(uint8_t)(1<<(ii%8));
+      }
+      else
+      {
+	col.nullCount++;
+      }
+    }
+    if(col.nullCount==0)
+    {
+      col.validity.clear();
+    }
+  }
+  mColumns.push_back(col);
+}
+
+// Schema table for the columns:  endianness (little, the default), 
+// then the fields.  (A template so it can get at the writer's
+// Column type.)
+template<class Columns>
+static size_t SchemaTable(FlatBuffer& fb, const Columns& columns)
+{
+  static const int schemaSizes[]={ 0, 4 };
+  size_t schemaField[2];
+  size_t schema=fb.Table(schemaSizes, 2, schemaField);
+  size_t fields=fb.Vector(columns.size(), 4, 4);
+  fb.Link(schemaField[1], fields);
+
+  for(size_t ic=0; ic<columns.size(); ic++)
+  {
+    // Field table:  name, nullable, type_type, type, dictionary,
+    // children.
+    static const int fieldSizes[]={ 4, 1, 1, 4, 0, 4 };
+    size_t field[6];
+    size_t table=fb.Table(fieldSizes, 6, field);
+    fb.Link(fields+4+4*ic, table);
+    fb.Set<uint8_t>(field[1], columns[ic].nullable ? 1 : 0);
+    fb.Set<uint8_t>(field[2], 
+                    columns[ic].isDouble ? TYPE_FLOATING_POINT : TYPE_INT);
+
+    fb.Link(field[0], fb.String(columns[ic].name));
+
+    if(columns[ic].isDouble)
+    {
+      // FloatingPoint table:  precision.
+      static const int fpSizes[]={ 2 };
+      size_t fpField[1];
+      fb.Link(field[3], fb.Table(fpSizes, 1, fpField));
+      fb.Set<int16_t>(fpField[0], PRECISION_DOUBLE);
+    }
+    else
+    {
+      // Int table:  bitWidth, is_signed.
+      static const int intSizes[]={ 4, 1 };
+      size_t intField[2];
+      fb.Link(field[3], fb.Table(intSizes, 2, intField));
+      fb.Set<int32_t>(intField[0], 32);
+      fb.Set<uint8_t>(intField[1], 1);
+    }
+
+    fb.Link(field[5], fb.Vector(0, 4, 4));
+  }
+  return schema;
+}
+
+void GHCNArrowWriter::BuildSchemaMessage(vector<uint8_t>& bytes) const
+{
+  FlatBuffer fb(bytes);
+  size_t header;
+  fb.SetRoot(MessageTable(fb, HEADER_SCHEMA, 0, header));
+  fb.Link(header, SchemaTable(fb, mColumns));
+}
+
+void GHCNArrowWriter::BuildBatchMessage(int64_t bodyLength,
+                                        vector<uint8_t>& bytes) const
+{
+  FlatBuffer fb(bytes);
+  size_t header;
+  fb.SetRoot(MessageTable(fb, HEADER_RECORD_BATCH, bodyLength, header));
+
+  // RecordBatch table:  length, nodes, buffers.
+  static const int sizes[]={ 8, 4, 4 };
+  size_t field[3];
+  size_t table=fb.Table(sizes, 3, field);
+  fb.Link(header, table);
+  fb.Set<int64_t>(field[0], mColumns.empty() ? 0 : mColumns[0].length);
+
+  // A FieldNode (length, null count) per column...
+  size_t nodes=fb.Vector(mColumns.size(), 16, 8);
+  fb.Link(field[1], nodes);
+  for(size_t ic=0; ic<mColumns.size(); ic++)
+  {
+    fb.Set<int64_t>(nodes+4+16*ic, mColumns[ic].length);
+    fb.Set<int64_t>(nodes+12+16*ic, mColumns[ic].nullCount);
+  }
+
+  // ...and a Buffer (offset, length in the body) for each column's
+  // validity bitmap and values.
+  size_t buffers=fb.Vector(2*mColumns.size(), 16, 8);
+  fb.Link(field[2], buffers);
+  int64_t offset=0;
+  for(size_t ic=0; ic<mColumns.size(); ic++)
+  {
+    const Column& col=mColumns[ic];
+    size_t buf=buffers+4+32*ic;
+    fb.Set<int64_t>(buf, offset);
+    fb.Set<int64_t>(buf+8, col.validity.size());
+    offset+=Pad8(col.validity.size());
+    fb.Set<int64_t>(buf+16, offset);
+    fb.Set<int64_t>(buf+24, col.values.size());
+    offset+=Pad8(col.values.size());
+  }
+}
+
+void GHCNArrowWriter::BuildFooter(int64_t batchOffset, int32_t batchMetaLength,
+                                  int64_t batchBodyLength,
+                                  vector<uint8_t>& bytes) const
+{
+  FlatBuffer fb(bytes);
+
+  // Footer table:  version, schema, dictionaries, recordBatches.
+  static const int sizes[]={ 2, 4, 4, 4 };
+  size_t field[4];
+  size_t table=fb.Table(sizes, 4, field);
+  fb.SetRoot(table);
+  fb.Set<int16_t>(field[0], METADATA_V5);
+  fb.Link(field[1], SchemaTable(fb, mColumns));
+  fb.Link(field[2], fb.Vector(0, 24, 8));
+
+  // One Block (offset, metadata length, body length) for the batch.
+  size_t blocks=fb.Vector(1, 24, 8);
+  fb.Link(field[3], blocks);
+  fb.Set<int64_t>(blocks+4, batchOffset);
+  fb.Set<int32_t>(blocks+12, batchMetaLength);
+  fb.Set<int64_t>(blocks+20, batchBodyLength);
+}
+
+bool GHCNArrowWriter::Write(const string& fileName) const
+{
+  for(size_t ic=1; ic<mColumns.size(); ic++)
+  {
+    if(mColumns[ic].length!=mColumns[0].length)
+    {
+      return false;
+    }
+  }
+
+  ofstream out(fileName.c_str(), ios::binary);
+  if(!out)
+  {
+    return false;
+  }
+  out.write("ARROW1\0\0", 8);
+
+  vector<uint8_t> fb;
+  BuildSchemaMessage(fb);
+  WriteMessage(out, fb);
+
+  int64_t bodyLength=0;
+  for(size_t ic=0; ic<mColumns.size(); ic++)
+  {
+    bodyLength+=Pad8(mColumns[ic].validity.size())
+      +Pad8(mColumns[ic].values.size());
+  }
+  int64_t batchOffset=(int64_t)out.tellp();
+  BuildBatchMessage(bodyLength, fb);
+  WriteMessage(out, fb);
+  int32_t batchMetaLength=(int32_t)(8+fb.size());
+
+  for(size_t ic=0; ic<mColumns.size(); ic++)
+  {
+    const Column& col=mColumns[ic];
+    WritePadded(out, (const char*)col.validity.data(), col.validity.size());
+    WritePadded(out, col.values.data(), col.values.size());
+  }
+
+  // End of stream, then the footer.
+  uint32_t eos[2]={ 0xFFFFFFFF, 0 };
+  out.write((const char*)eos, sizeof(eos));
+
+  BuildFooter(batchOffset, batchMetaLength, bodyLength, fb);
+  int32_t footerLength=(int32_t)fb.size();
+  out.write((const char*)fb.data(), fb.size());
+  out.write((const char*)&footerLength, 4);
+  out.write("ARROW1", 6);
+
+  return !out.fail();
+}
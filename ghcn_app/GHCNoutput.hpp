@@ -0,0 +1,100 @@
+#ifndef GHCNOUTPUT_HPP
+#define GHCNOUTPUT_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+//
+// Output writers:  a buffered CSV writer, and a writer for tables of
+// typed columns in the Arrow IPC file format.
+//
+
+
+// Formats CSV fields into a buffer and hands it to the stream in big
+// pieces, instead of one << (and, with endl, one flush) per field.
+// Numbers come out the same as with << and the stream's default
+// settings (doubles to 6 significant digits).
+class GHCNCsvWriter
+{
+ public:
+
+  explicit GHCNCsvWriter(std::ostream& out);
+  virtual ~GHCNCsvWriter();   // flushes
+
+  void  Put(int value);
+  void  Put(double value);
+  void  Put(char cc);
+  void  Put(const std::string& text);
+
+  // End the line (no flush).
+  void  EndLine(void) { Put('\n'); }
+
+  // Pass everything buffered on to the stream, and flush that.
+  void  Flush(void);
+
+ protected:
+
+  std::ostream& mOut;
+  std::vector<char> mBuffer;
+  size_t mUsed;
+
+  static const size_t BUFFER_BYTES=1<<16;
+
+  void  Append(const char *text, size_t nn);
+
+ private:
+  GHCNCsvWriter(const GHCNCsvWriter&);
+  GHCNCsvWriter& operator=(const GHCNCsvWriter&);
+
+};
+
+
+// One table of equal-length columns, written as an Arrow IPC file
+// (also known as Feather v2):  the schema, one record batch and the
+// footer, uncompressed and little-endian.  pandas, polars, R and
+// anything else built on Arrow load it straight into typed columns,
+// with no text parsing.
+class GHCNArrowWriter
+{
+ public:
+
+  GHCNArrowWriter() {}
+
+  void  AddColumn(const std::string& name, const std::vector<int32_t>& values);
+
+  // valid[ii]==0 marks values[ii] as null.  An empty valid makes the
+  // column non-nullable.
+  void  AddColumn(const std::string& name, const std::vector<double>& values,
+                  const std::vector<unsigned char>& valid);
+
+  // False if the file can't be written, or the columns aren't all the
+  // same length.
+  bool  Write(const std::string& fileName) const;
+
+ protected:
+
+  struct Column
+  {
+    std::string name;
+    bool isDouble;                 // else int32
+    bool nullable;
+    int64_t length;
+    int64_t nullCount;
+    std::vector<char> values;      // raw little-endian values
+    std::vector<uint8_t> validity; // Arrow bitmap;  empty if no nulls
+  };
+  std::vector<Column> mColumns;
+
+  // Flatbuffer-encoded metadata.
+  void  BuildSchemaMessage(std::vector<uint8_t>& fb) const;
+  void  BuildBatchMessage(int64_t bodyLength, std::vector<uint8_t>& fb) const;
+  void  BuildFooter(int64_t batchOffset, int32_t batchMetaLength,
+                    int64_t batchBodyLength, std::vector<uint8_t>& fb) const;
+
+};
+
+#endif // GHCNOUTPUT_HPP
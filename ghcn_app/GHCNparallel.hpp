@@ -0,0 +1,61 @@
+#ifndef GHCNPARALLEL_HPP
+#define GHCNPARALLEL_HPP
+
+#include <thread>
+#include <atomic>
+#include <vector>
+
+
+// Number of hardware threads, or 1 if that can't be determined.
+inline int GHCNHardwareThreads(void)
+{
+  unsigned nn=std::thread::hardware_concurrency();
+  return nn>0 ? (int)nn : 1;
+}
+
+
+// Run task(0) ... task(ntasks-1) on a pool of at most nthreads threads,
+// the calling thread included.  Task indices are handed out one at a
+// time in increasing order, so uneven task sizes even out across the
+// pool.  Returns once every task has finished.
+template<class Task>
+void GHCNParallelFor(int ntasks, int nthreads, Task task)
+{
+  if(nthreads>ntasks)
+  {
+    nthreads=ntasks;
+  }
+
+  if(nthreads<=1)
+  {
+    for(int ii=0; ii<ntasks; ii++)
+    {
+      task(ii);
+    }
+    return;
+  }
+
+  std::atomic<int> next(0);
+  auto worker=[&]()
+  {
+    int ii;
+    while((ii=next++)<ntasks)
+    {
+      task(ii);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for(int it=1; it<nthreads; it++)
+  {
+    pool.push_back(std::thread(worker));
+  }
+  worker();
+
+  for(size_t it=0; it<pool.size(); it++)
+  {
+    pool[it].join();
+  }
+}
+
+#endif // GHCNPARALLEL_HPP
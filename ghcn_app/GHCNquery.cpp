@@ -0,0 +1,261 @@
+#include "GHCNcsv.hpp"
+#include "GHCNquery.hpp"
+#include "GHCNstats.hpp"
+#include "GHCNoutput.hpp"
+
+#include <sstream>
+#include <string.h>
+
+
+GHCNQuery::GHCNQuery()
+  : avgNyear(GHCN::DEFAULT_AVG_NYEAR),
+    minBaselineSampleCount(GHCN::DEFAULT_MIN_BASELINE_SAMPLE_COUNT),
+    mergeMode(GHCN::MERGE_AVG),
+    firstBaselineYear(GHCN::FIRST_BASELINE_YEAR),
+    lastBaselineYear(GHCN::LAST_BASELINE_YEAR),
+    hasRegion(false)
+{
+  region.lat0=region.lat1=0;
+  region.lon0=region.lon1=0;
+}
+
+// Parse "a,b,c..." into values;  false if any item isn't a number.
+static bool ParseNumberList(const string& text, vector<double>& values)
+{
+  istringstream list(text);
+  string item;
+
+  values.clear();
+  while(getline(list, item, ','))
+  {
+    char *end;
+    double vv=strtod(item.c_str(), &end);
+    if(item.empty() || *end!='\0')
+    {
+      return false;
+    }
+    values.push_back(vv);
+  }
+  return !values.empty();
+}
+
+static bool ParseQueryWord(const string& key, const string& value, 
+                           bool haveInventory, GHCNQuery& query)
+{
+  vector<double> nums;
+
+  if(key=="name")
+  {
+    query.name=value;
+  }
+  else if(key=="A")
+  {
+    query.avgNyear=MAX(1,MIN(GHCN::MAX_AVG_NYEAR,atoi(value.c_str())));
+  }
+  else if(key=="B")
+  {
+    query.minBaselineSampleCount=atoi(value.c_str());
+  }
+  else if(key=="merge")
+  {
+    if(value=="avg")
+    {
+      query.mergeMode=GHCN::MERGE_AVG;
+    }
+    else if(value=="max")
+    {
+      query.mergeMode=GHCN::MERGE_MAX;
+    }
+    else if(value=="min")
+    {
+      query.mergeMode=GHCN::MERGE_MIN;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  else if(key=="baseline")
+  {
+    if(sscanf(value.c_str(), "%d-%d", &query.firstBaselineYear, 
+	      &query.lastBaselineYear)!=2
+       || query.firstBaselineYear>query.lastBaselineYear)
+    {
+      return false;
+    }
+  }
+  else if(key=="country")
+  {
+    if(!GHCNParseCountryList(value, query.countries))
+    {
+      return false;
+    }
+  }
+  else if(key=="region")
+  {
+    if(!haveInventory || !ParseNumberList(value, nums) || nums.size()!=4
+       || nums[0]>nums[1])
+    {
+      return false;
+    }
+    query.hasRegion=true;
+    query.region.lat0=nums[0];
+    query.region.lat1=nums[1];
+    query.region.lon0=nums[2];
+    query.region.lon1=nums[3];
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+bool GHCNParseQuery(const string& line, const GHCNQuery& defaults,
+                    bool haveInventory, GHCNQuery& query, string& error)
+{
+  istringstream words(line);
+  string word;
+
+  query=defaults;
+  while(words >> word)
+  {
+    size_t eq=word.find('=');
+    if(eq==string::npos 
+       || !ParseQueryWord(word.substr(0,eq), word.substr(eq+1), 
+			  haveInventory, query))
+    {
+      error="bad query setting \""+word+"\"";
+      return false;
+    }
+  }
+
+  query.minBaselineSampleCount=MAX(1, MIN(query.lastBaselineYear
+					  -query.firstBaselineYear+1,
+					  query.minBaselineSampleCount));
+  return true;
+}
+
+bool GHCNReadQueries(const char *fileName, const GHCNQuery& defaults,
+                     bool haveInventory, vector<GHCNQuery>& queries)
+{
+  ifstream in(fileName);
+  if(!in)
+  {
+    cerr << "Can't read query file " << fileName << endl;
+    return false;
+  }
+
+  string line;
+  int lineNo=0;
+  queries.clear();
+  while(getline(in, line))
+  {
+    lineNo++;
+    line=line.substr(0, line.find('#'));
+    if(line.find_first_not_of(" \t\r")==string::npos)
+    {
+      continue;
+    }
+
+    GHCNQuery query;
+    string error;
+    if(!GHCNParseQuery(line, defaults, haveInventory, query, error))
+    {
+      cerr << fileName << ":" << lineNo << ": " << error << endl;
+      return false;
+    }
+
+    if(query.name.empty())
+    {
+      ostringstream name;
+      name << "q" << queries.size()+1;
+      query.name=name.str();
+    }
+    queries.push_back(query);
+  }
+
+  if(queries.empty())
+  {
+    cerr << "No queries in " << fileName << endl;
+    return false;
+  }
+  return true;
+}
+
+void GHCNRunQuery(GHCN& ghcn, const GHCNQuery& query, 
+                  map<int,double>& series)
+{
+  vector<int> subset;
+
+  ghcn.SetFilter(query.countries, query.hasRegion ? &query.region : NULL);
+  if(!query.countries.empty() || query.hasRegion)
+  {
+    ghcn.SelectStations(subset);
+    ghcn.SetStationSubset(subset);
+  }
+  else
+  {
+    ghcn.ClearStationSubset();
+  }
+  // (query may not outlive this call.)
+  ghcn.SetFilter(vector<GHCNStationKey>(), NULL);
+
+  ghcn.SetBaselineWindow(query.firstBaselineYear, query.lastBaselineYear);
+  ghcn.ComputeBaselines();
+  ghcn.ComputeGlobalAverageAnomalies(query.minBaselineSampleCount);
+  ghcn.MergeMonthsToYear((GHCN::MERGE_MODE)query.mergeMode);
+  ghcn.ComputeMovingAvg(query.avgNyear);
+  series.swap(ghcn.mSmoothedGlobalAverageAnnualAnomalies);
+}
+
+void GHCNRunQueries(GHCN& ghcn, const vector<GHCNQuery>& queries,
+                    ostream& out, GHCNStats& stats)
+{
+  vector< map<int,double> > results(queries.size());
+
+  for(size_t iq=0; iq<queries.size(); iq++)
+  {
+    const GHCNQuery& query=queries[iq];
+    string stage="query "+query.name;
+    stats.StartStage(stage.c_str());
+    GHCNRunQuery(ghcn, query, results[iq]);
+
+    stats.EndStage();
+  }
+
+  // Every year any query has a result for.
+  set<int> years;
+  for(size_t iq=0; iq<results.size(); iq++)
+  {
+    for(map<int,double>::const_iterator it=results[iq].begin();
+	it!=results[iq].end(); it++)
+    {
+      years.insert(it->first);
+    }
+  }
+
+  GHCNCsvWriter csv(out);
+  csv.Put(string("year"));
+  for(size_t iq=0; iq<queries.size(); iq++)
+  {
+    csv.Put(',');
+    csv.Put(queries[iq].name);
+  }
+  csv.EndLine();
+
+  for(set<int>::const_iterator iy=years.begin(); iy!=years.end(); iy++)
+  {
+    csv.Put(*iy);
+    for(size_t iq=0; iq<results.size(); iq++)
+    {
+      csv.Put(',');
+      map<int,double>::const_iterator it=results[iq].find(*iy);
+      if(it!=results[iq].end())
+      {
+	csv.Put(it->second);
+      }
+    }
+    csv.EndLine();
+  }
+}
@@ -0,0 +1,80 @@
+#ifndef GHCNQUERY_HPP
+#define GHCNQUERY_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+#include "GHCNinventory.hpp"
+
+class GHCN;
+class GHCNStats;
+
+//
+// Batch mode:  many parameter combinations run against one dataset.
+//
+// A query file has one query per line, made of key=value words:
+//
+//   name=NAME          column heading (default q1, q2...)
+//   A=N                smoothing filter length in years
+//   B=N                min baseline sample count
+//   merge=avg|max|min  how months are merged into a year
+//   baseline=Y0-Y1     baseline period
+//   country=C[,C...]   GHCN country numbers or FIPS letter codes
+//   region=LAT0,LAT1,LON0,LON1   lat/lon box (needs --inventory)
+//
+// Anything left out comes from the command line.  Blank lines and
+// anything after a '#' are ignored.
+//
+struct GHCNQuery
+{
+  // GHCN's DEFAULT_* settings, averaged months and all stations.
+  GHCNQuery();
+
+  std::string name;
+  int avgNyear;
+  int minBaselineSampleCount;
+  int mergeMode;                 // a GHCN::MERGE_MODE
+  int firstBaselineYear;
+  int lastBaselineYear;
+  std::vector<GHCNStationKey> countries;   // GHCNCountryKey()s
+  bool hasRegion;
+  GHCNRegion region;
+};
+
+// Parse one query:  the key=value words of one line of a query file
+// (no comment).  Returns false, with the reason in error, if there's
+// a bad word.  query.name is left empty unless the line names it.
+bool GHCNParseQuery(const std::string& line, const GHCNQuery& defaults,
+                    bool haveInventory, GHCNQuery& query, 
+                    std::string& error);
+
+// Returns false (with a message on cerr) if the file can't be read or
+// has a bad line.  Regions are only allowed if haveInventory.
+bool GHCNReadQueries(const char *fileName, const GHCNQuery& defaults,
+                     bool haveInventory, std::vector<GHCNQuery>& queries);
+
+// Run one query against ghcn, which has had ReadTemps() done:  its
+// smoothed annual anomalies, by year, end up in series.  This, the
+// GHCN constructor and ReadTemps() are all it takes to use the
+// analysis from other code:
+//
+//   GHCN ghcn("v2.mean", GHCN::DEFAULT_AVG_NYEAR);
+//   ghcn.ReadTemps();
+//   GHCNRunQuery(ghcn, query, series);
+//
+// Calls on one GHCN object mustn't overlap.
+void GHCNRunQuery(GHCN& ghcn, const GHCNQuery& query,
+                  std::map<int,double>& series);
+
+// Run the queries against ghcn, which has had ReadTemps() done, and 
+// write one CSV table:  a heading line, then the year and each query's 
+// smoothed anomaly for that year (blank where a query has none).
+// The parsed stations are shared by all the queries, and baselines are
+// only computed once per baseline period.  Each query's time goes into
+// stats as a stage.
+void GHCNRunQueries(GHCN& ghcn, const std::vector<GHCNQuery>& queries,
+                    std::ostream& out, GHCNStats& stats);
+
+#endif // GHCNQUERY_HPP
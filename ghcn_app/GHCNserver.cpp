@@ -0,0 +1,269 @@
+#include "GHCNcsv.hpp"
+#include "GHCNserver.hpp"
+
+#if defined(_WIN32)
+
+bool GHCNServe(const char *socketPath, const vector<GHCN*>& datasets,
+               const vector<string>& names, const GHCNQuery& defaults,
+               bool haveInventory)
+{
+  cerr << "--serve isn't available on Windows" << endl;
+  return false;
+}
+
+#else
+
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace
+{
+
+// Everything the client threads share.
+struct Server
+{
+  int listenFd;
+  const vector<GHCN*> *datasets;
+  const vector<string> *names;
+  const GHCNQuery *defaults;
+  bool haveInventory;
+
+  // One per dataset:  queries on a dataset take turns.
+  vector<mutex> *datasetMutex;
+
+  atomic<bool> stopping;
+
+  // Connections still open, so a shutdown can close them.
+  mutex clientMutex;
+  condition_variable clientsDone;
+  set<int> clients;
+};
+
+bool WriteAll(int fd, const string& text)
+{
+  const char *pp=text.data();
+  size_t left=text.size();
+
+  while(left>0)
+  {
+    ssize_t nn=write(fd, pp, left);
+    if(nn<0 && errno==EINTR)
+    {
+      continue;
+    }
+    if(nn<=0)
+    {
+      return false;
+    }
+    pp+=nn;
+    left-=nn;
+  }
+  return true;
+}
+
+// The reply to one query line (without the empty line that ends it).
+string AnswerQuery(Server& server, const string& line)
+{
+  // Pick out the dataset;  everything else is the query.
+  istringstream words(line);
+  string word, rest;
+  int idata=0;
+  while(words >> word)
+  {
+    if(word.compare(0, 5, "file=")==0)
+    {
+      const vector<string>& names=*server.names;
+      idata=(int)(find(names.begin(), names.end(), word.substr(5))
+		  -names.begin());
+      if(idata==(int)names.size())
+      {
+	return "error: no dataset " + word.substr(5) + "\n";
+      }
+    }
+    else
+    {
+      rest+=word+" ";
+    }
+  }
+
+  GHCNQuery query;
+  string error;
+  if(!GHCNParseQuery(rest, *server.defaults, server.haveInventory,
+		     query, error))
+  {
+    return "error: " + error + "\n";
+  }
+
+  map<int,double> series;
+  {
+    lock_guard<mutex> lock((*server.datasetMutex)[idata]);
+    GHCNRunQuery(*(*server.datasets)[idata], query, series);
+  }
+
+  ostringstream reply;
+  for(map<int,double>::const_iterator it=series.begin();
+      it!=series.end(); it++)
+  {
+    reply << it->first << "," << it->second << "\n";
+  }
+  return reply.str();
+}
+
+void ServeClient(Server& server, int fd)
+{
+  string pending;
+  char buf[4096];
+  bool open=true;
+
+  while(open)
+  {
+    ssize_t nn=read(fd, buf, sizeof(buf));
+    if(nn<0 && errno==EINTR)
+    {
+      continue;
+    }
+    if(nn<=0)
+    {
+      break;
+    }
+    pending.append(buf, nn);
+
+    size_t eol;
+    while(open && (eol=pending.find('\n'))!=string::npos)
+    {
+      string line=pending.substr(0, eol);
+      pending.erase(0, eol+1);
+      if(!line.empty() && line[line.size()-1]=='\r')
+      {
+	line.erase(line.size()-1);
+      }
+
+      if(line=="quit")
+      {
+	open=false;
+      }
+      else if(line=="shutdown")
+      {
+	// Reply first:  stopping hangs up on every client, this one too.
+	WriteAll(fd, "\n");
+	server.stopping=true;
+	shutdown(server.listenFd, SHUT_RDWR);
+	open=false;
+      }
+      else
+      {
+	open=WriteAll(fd, AnswerQuery(server, line)+"\n");
+      }
+    }
+  }
+
+  // Out of the set before the descriptor is closed, so a shutdown 
+  // can't hit a reused descriptor number.
+  lock_guard<mutex> lock(server.clientMutex);
+  server.clients.erase(fd);
+  close(fd);
+  server.clientsDone.notify_all();
+}
+
+}
+
+
+bool GHCNServe(const char *socketPath, const vector<GHCN*>& datasets,
+               const vector<string>& names, const GHCNQuery& defaults,
+               bool haveInventory)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family=AF_UNIX;
+  if(strlen(socketPath)>=sizeof(addr.sun_path))
+  {
+    cerr << "Socket path too long: " << socketPath << endl;
+    return false;
+  }
+  strcpy(addr.sun_path, socketPath);
+
+  // A socket left over from an earlier run can go, but nothing else.
+  struct stat st;
+  if(lstat(socketPath, &st)==0)
+  {
+    if(!S_ISSOCK(st.st_mode))
+    {
+      cerr << socketPath << " exists and isn't a socket" << endl;
+      return false;
+    }
+    unlink(socketPath);
+  }
+
+  int fd=socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd<0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr))!=0
+     || listen(fd, 16)!=0)
+  {
+    cerr << "Can't listen on " << socketPath << ": " << strerror(errno)
+	 << endl;
+    if(fd>=0)
+    {
+      close(fd);
+    }
+    return false;
+  }
+
+  // A client that goes away mid-reply mustn't take the server with it.
+  signal(SIGPIPE, SIG_IGN);
+
+  vector<mutex> datasetMutex(datasets.size());
+  Server server;
+  server.listenFd=fd;
+  server.datasets=&datasets;
+  server.names=&names;
+  server.defaults=&defaults;
+  server.haveInventory=haveInventory;
+  server.datasetMutex=&datasetMutex;
+  server.stopping=false;
+
+  cerr << "Serving " << datasets.size() << " datasets on " << socketPath
+       << endl;
+
+  while(!server.stopping)
+  {
+    int cfd=accept(fd, NULL, NULL);
+    if(cfd<0)
+    {
+      if(errno==EINTR || errno==ECONNABORTED)
+      {
+	continue;
+      }
+      break;
+    }
+
+    lock_guard<mutex> lock(server.clientMutex);
+    server.clients.insert(cfd);
+    thread(ServeClient, ref(server), cfd).detach();
+  }
+
+  // Hang up on everyone still connected and wait for their threads.
+  {
+    unique_lock<mutex> lock(server.clientMutex);
+    for(set<int>::const_iterator it=server.clients.begin();
+	it!=server.clients.end(); it++)
+    {
+      shutdown(*it, SHUT_RDWR);
+    }
+    server.clientsDone.wait(lock, [&]() { return server.clients.empty(); });
+  }
+
+  close(fd);
+  unlink(socketPath);
+  return true;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef GHCNSERVER_HPP
+#define GHCNSERVER_HPP
+
+#include <string>
+#include <vector>
+
+#include "GHCNquery.hpp"
+
+class GHCN;
+
+//
+// Query server:  keeps parsed datasets in memory and answers queries
+// from local clients over a Unix-domain socket, so a query costs the
+// analysis alone instead of a whole run.
+//
+// Clients send one request per line and get the reply back before 
+// the next one is read:
+//
+//   [file=NAME] key=value...   a query, as in a query file (see 
+//                              GHCNquery.hpp);  NAME is one of the
+//                              server's input files as given on its
+//                              command line, the first if left out.
+//                              Reply:  "year,anomaly" lines.
+//   quit                       close this connection.
+//   shutdown                   stop the server.
+//
+// Every reply ends with an empty line;  a bad request gets a single
+// "error: ..." line instead.  Clients are served concurrently, but 
+// queries on the same dataset take turns.
+//
+// Not available on Windows.
+//
+
+// Serve the datasets (each with ReadTemps() done) under their names.
+// Returns when a client asks for a shutdown, or false straight away
+// if the socket can't be set up.
+bool GHCNServe(const char *socketPath, const std::vector<GHCN*>& datasets,
+               const std::vector<std::string>& names,
+               const GHCNQuery& defaults, bool haveInventory);
+
+#endif // GHCNSERVER_HPP
@@ -0,0 +1,81 @@
+#include "GHCNstats.hpp"
+
+#include <stdio.h>
+
+
+void GHCNStats::StartStage(const char *name)
+{
+  mStageName=name;
+  mStageTimer.Restart();
+}
+
+void GHCNStats::EndStage(void)
+{
+  Stage stage;
+  stage.name=mStageName;
+  stage.wallSeconds=mStageTimer.WallSeconds();
+  stage.cpuSeconds=mStageTimer.CpuSeconds();
+  stage.peakRSSBytes=GHCNPeakRSSBytes();
+  mStages.push_back(stage);
+}
+
+void GHCNStats::AddCounter(const char *name, int64_t value)
+{
+  mCounters.push_back(std::make_pair(std::string(name), value));
+}
+
+void GHCNStats::WriteJsonMembers(std::ostream& os, const char *indent) const
+{
+  char num[64];
+
+  os << indent << "\"stages\": [";
+  for(size_t ii=0; ii<mStages.size(); ii++)
+  {
+    const Stage& st=mStages[ii];
+    os << (ii>0 ? "," : "") << std::endl << indent << "  {\"name\": " 
+       << GHCNJsonString(st.name);
+    snprintf(num, sizeof(num), "%.6f", st.wallSeconds);
+    os << ", \"wall_s\": " << num;
+    snprintf(num, sizeof(num), "%.6f", st.cpuSeconds);
+    os << ", \"cpu_s\": " << num
+       << ", \"peak_rss_bytes\": " << (uint64_t)st.peakRSSBytes << "}";
+  }
+  os << std::endl << indent << "]," << std::endl;
+
+  os << indent << "\"counters\": {";
+  for(size_t ii=0; ii<mCounters.size(); ii++)
+  {
+    os << (ii>0 ? "," : "") << std::endl << indent << "  " 
+       << GHCNJsonString(mCounters[ii].first) << ": " 
+       << (long long)mCounters[ii].second;
+  }
+  os << std::endl << indent << "}";
+}
+
+std::string GHCNJsonString(const std::string& s)
+{
+  std::string out("\"");
+
+  for(size_t ii=0; ii<s.size(); ii++)
+  {
+    unsigned char cc=(unsigned char)s[ii];
+    if(cc=='"' || cc=='\\')
+    {
+      out+='\\';
+      out+=(char)cc;
+    }
+    else if(cc<0x20)
+    {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", cc);
+      out+=esc;
+    }
+    else
+    {
+      out+=(char)cc;
+    }
+  }
+
+  out+='"';
+  return out;
+}
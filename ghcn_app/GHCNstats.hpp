@@ -0,0 +1,56 @@
+#ifndef GHCNSTATS_HPP
+#define GHCNSTATS_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <ostream>
+
+#include "GHCNtimer.hpp"
+
+//
+// Stage timings and counters for one input file (or the whole run),
+// written out as JSON for --stats.
+//
+class GHCNStats
+{
+ public:
+
+  GHCNStats() {}
+
+  // Time everything up to the next EndStage() as stage name.
+  void  StartStage(const char *name);
+  void  EndStage(void);
+
+  void  AddCounter(const char *name, int64_t value);
+
+  // The stages and counters as JSON object members
+  //   "stages": [...], "counters": {...}
+  // one per line, each line starting with indent.
+  void  WriteJsonMembers(std::ostream& os, const char *indent) const;
+
+ protected:
+
+  struct Stage
+  {
+    std::string name;
+    double wallSeconds;
+    double cpuSeconds;
+    size_t peakRSSBytes;   // process high-water mark at the end of the stage
+  };
+
+  std::vector<Stage> mStages;
+  std::vector< std::pair<std::string,int64_t> > mCounters;
+
+  std::string mStageName;
+  GHCNStopwatch mStageTimer;
+
+};
+
+// s as a quoted, escaped JSON string.
+std::string GHCNJsonString(const std::string& s);
+
+#endif // GHCNSTATS_HPP
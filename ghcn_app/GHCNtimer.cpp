@@ -0,0 +1,68 @@
+#include "GHCNtimer.hpp"
+
+#include <chrono>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+
+double GHCNWallSeconds(void)
+{
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double GHCNCpuSeconds(void)
+{
+#if defined(_WIN32)
+  FILETIME created, exited, kernel, user;
+  if(!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+  {
+    return 0.0;
+  }
+  ULARGE_INTEGER kk, uu;
+  kk.LowPart=kernel.dwLowDateTime;
+  kk.HighPart=kernel.dwHighDateTime;
+  uu.LowPart=user.dwLowDateTime;
+  uu.HighPart=user.dwHighDateTime;
+  // FILETIME counts 100ns ticks.
+  return (kk.QuadPart+uu.QuadPart)*1.0e-7;
+#else
+  struct rusage ru;
+  if(getrusage(RUSAGE_SELF, &ru)!=0)
+  {
+    return 0.0;
+  }
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1.0e-6
+    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1.0e-6;
+#endif
+}
+
+size_t GHCNPeakRSSBytes(void)
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS pmc;
+  if(!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+  {
+    return 0;
+  }
+  return pmc.PeakWorkingSetSize;
+#else
+  struct rusage ru;
+  if(getrusage(RUSAGE_SELF, &ru)!=0)
+  {
+    return 0;
+  }
+#if defined(__APPLE__)
+  return (size_t)ru.ru_maxrss;        // bytes on macOS
+#else
+  return (size_t)ru.ru_maxrss*1024;   // kilobytes on Linux
+#endif
+#endif
+}
@@ -0,0 +1,45 @@
+#ifndef GHCNTIMER_HPP
+#define GHCNTIMER_HPP
+
+#include <stddef.h>
+
+//
+// Clocks and memory figures for timing the stages of a run.
+//
+
+
+// Seconds on a monotonic wall clock (arbitrary origin).
+double GHCNWallSeconds(void);
+
+// User+system CPU seconds used by the whole process so far.
+double GHCNCpuSeconds(void);
+
+// High-water mark of the process's resident set, in bytes (0 if the
+// OS won't tell us).
+size_t GHCNPeakRSSBytes(void);
+
+
+// Wall and CPU time since construction (or the last Restart()).
+class GHCNStopwatch
+{
+ public:
+
+  GHCNStopwatch() { Restart(); }
+
+  void Restart(void)
+  {
+    mWallStart=GHCNWallSeconds();
+    mCpuStart=GHCNCpuSeconds();
+  }
+
+  double WallSeconds(void) const { return GHCNWallSeconds()-mWallStart; }
+  double CpuSeconds(void) const { return GHCNCpuSeconds()-mCpuStart; }
+
+ protected:
+
+  double mWallStart;
+  double mCpuStart;
+
+};
+
+#endif // GHCNTIMER_HPP